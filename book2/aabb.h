@@ -0,0 +1,64 @@
+#ifndef AABBH
+#define AABBH
+
+#include "ray.h"
+
+inline float ffmin(float a, float b) { return a < b ? a : b; }
+inline float ffmax(float a, float b) { return a > b ? a : b; }
+
+// axis aligned bounding box
+class aabb
+{
+    public:
+        aabb() {}
+        aabb(const vec3& a, const vec3& b) { _min = a; _max = b; }
+        vec3 min() const {return _min; }
+        vec3 max() const {return _max; }
+
+        // slab test (Andrew Kensler's version from the book)
+        bool hit(const ray& r, float tmin, float tmax) const
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                float invD = 1.0f / r.direction()[a];
+                float t0 = (_min[a] - r.origin()[a]) * invD;
+                float t1 = (_max[a] - r.origin()[a]) * invD;
+                if (invD < 0.0f)
+                {
+                    float temp = t0; t0 = t1; t1 = temp;
+                }
+                tmin = t0 > tmin ? t0 : tmin;
+                tmax = t1 < tmax ? t1 : tmax;
+                if (tmax <= tmin)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // surface area, used by the surface area heuristic
+        float area() const
+        {
+            vec3 d = _max - _min;
+            return 2.0f*(d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+        }
+
+        vec3 centroid() const {return 0.5f*(_min + _max); }
+
+        vec3 _min;
+        vec3 _max;
+};
+
+aabb surrounding_box(const aabb& box0, const aabb& box1)
+{
+    vec3 small(ffmin(box0.min().x(), box1.min().x()),
+               ffmin(box0.min().y(), box1.min().y()),
+               ffmin(box0.min().z(), box1.min().z()));
+    vec3 big(ffmax(box0.max().x(), box1.max().x()),
+             ffmax(box0.max().y(), box1.max().y()),
+             ffmax(box0.max().z(), box1.max().z()));
+    return aabb(small, big);
+}
+
+#endif //AABBH
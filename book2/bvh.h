@@ -0,0 +1,166 @@
+#ifndef BVHH
+#define BVHH
+
+#include <algorithm>
+#include "hitable.h"
+
+// primitive reference used while building, keeps the box so it is only queried once
+struct bvh_primitive
+{
+    hitable *obj;
+    int index;
+    aabb box;
+    vec3 centroid;
+};
+
+// orders primitives along one axis by the center of their box
+struct bvh_centroid_compare
+{
+    bvh_centroid_compare(int a) : axis(a) {}
+    bool operator()(const bvh_primitive& p0, const bvh_primitive& p1) const
+    {
+        return p0.centroid[axis] < p1.centroid[axis];
+    }
+    int axis;
+};
+
+// sweeps every axis and finds the split with the lowest SAH cost,
+// cost = area(left)*count(left) + area(right)*count(right).
+// p is left sorted along the winning axis and the split index is returned.
+int sah_sweep_split(bvh_primitive *p, int n, float& best_cost, int *best_axis_out = NULL)
+{
+    float *right_area = new float[n];
+    int best_axis = 0;
+    int best_split = n/2;
+    best_cost = MAXFLOAT;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        std::sort(p, p+n, bvh_centroid_compare(axis));
+
+        aabb acc = p[n-1].box;
+        right_area[n-1] = acc.area();
+        for (int i = n-2; i > 0; i--)
+        {
+            acc = surrounding_box(acc, p[i].box);
+            right_area[i] = acc.area();
+        }
+
+        acc = p[0].box;
+        for (int i = 1; i < n; i++)
+        {
+            float cost = acc.area()*i + right_area[i]*(n-i);
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = i;
+            }
+            acc = surrounding_box(acc, p[i].box);
+        }
+    }
+    delete [] right_area;
+
+    // the last sort was on z, redo the winning axis if needed
+    if (best_axis != 2)
+    {
+        std::sort(p, p+n, bvh_centroid_compare(best_axis));
+    }
+    if (best_axis_out)
+    {
+        *best_axis_out = best_axis;
+    }
+    return best_split;
+}
+
+// bounding volume hierarchy, built top down with the surface area heuristic
+class bvh_node : public hitable
+{
+    public:
+        bvh_node() {}
+        bvh_node(hitable **l, int n);
+        bvh_node(bvh_primitive *p, int n) { build(p, n); }
+        virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        void build(bvh_primitive *p, int n);
+        hitable *left;
+        hitable *right;
+        aabb box;
+};
+
+bvh_node::bvh_node(hitable **l, int n)
+{
+    bvh_primitive *prims = new bvh_primitive[n];
+    for (int i = 0; i < n; i++)
+    {
+        prims[i].obj = l[i];
+        prims[i].index = i;
+        if (!l[i]->bounding_box(prims[i].box))
+        {
+            std::cerr << "ERROR; no bounding box in bvh_node constructor" << std::endl;
+        }
+        prims[i].centroid = prims[i].box.centroid();
+    }
+    build(prims, n);
+    delete [] prims;
+}
+
+void bvh_node::build(bvh_primitive *p, int n)
+{
+    box = p[0].box;
+    for (int i = 1; i < n; i++)
+    {
+        box = surrounding_box(box, p[i].box);
+    }
+
+    if (n == 1)
+    {
+        left = right = p[0].obj;
+        return;
+    }
+    if (n == 2)
+    {
+        left = p[0].obj;
+        right = p[1].obj;
+        return;
+    }
+
+    float best_cost;
+    int best_split = sah_sweep_split(p, n, best_cost);
+
+    left = best_split == 1 ? p[0].obj : new bvh_node(p, best_split);
+    right = n-best_split == 1 ? p[best_split].obj : new bvh_node(p+best_split, n-best_split);
+}
+
+bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    if (!box.hit(r, t_min, t_max))
+    {
+        return false;
+    }
+    // children only write rec on a hit, so the right side just gets a shorter ray
+    bool hit_left = left->hit(r, t_min, t_max, rec);
+    if (right == left)
+    {
+        return hit_left;
+    }
+    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+    return hit_left || hit_right;
+}
+
+bool bvh_node::occluded(const ray& r, float t_min, float t_max) const
+{
+    if (!box.hit(r, t_min, t_max))
+    {
+        return false;
+    }
+    return left->occluded(r, t_min, t_max) || (right != left && right->occluded(r, t_min, t_max));
+}
+
+bool bvh_node::bounding_box(aabb& b) const
+{
+    b = box;
+    return true;
+}
+
+#endif //BVHH
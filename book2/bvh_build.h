@@ -0,0 +1,752 @@
+#ifndef BVHBUILDH
+#define BVHBUILDH
+
+#include <pthread.h>
+#include <algorithm>
+#include "bvh.h"
+#include "parallel.h"
+
+// tree node used while building, flattened into linear_bvh_node afterwards
+struct bvh_build_node
+{
+    aabb bounds;
+    bvh_build_node *children[2];
+    int split_axis;
+    // every subtree covers a contiguous range of the (reordered) primitive array
+    int first_prim_offset;
+    int prim_count;
+    // only leaves have primitives of their own
+    int n_primitives;
+};
+
+// builders available for the flattened BVHs, from best tree quality to fastest build
+enum bvh_builder
+{
+    BVH_SWEEP_SAH,
+    BVH_BINNED_SAH,
+    BVH_LBVH
+};
+
+// leaves bigger than this are always split
+static const int bvh_max_prims_in_node = 4;
+// past this depth every builder (the LBVH too) splits into equal counts, which keeps
+// trees over up to 2^24 primitives (40 + 22 levels) within the traversal stack
+static const int bvh_max_sah_depth = 40;
+static const int bvh_stack_size = 64;
+// update() rebuilds instead of refitting once the SAH cost grew by this factor
+static const float bvh_refit_max_cost_growth = 1.5f;
+// SAH cost of a traversal step relative to one intersection
+static const float bvh_traversal_cost = 0.125f;
+
+bvh_build_node *make_leaf(bvh_primitive *base, bvh_primitive *p, int n, const aabb& bounds)
+{
+    bvh_build_node *node = new bvh_build_node;
+    node->bounds = bounds;
+    node->children[0] = node->children[1] = NULL;
+    node->split_axis = 0;
+    node->first_prim_offset = int(p - base);
+    node->prim_count = n;
+    node->n_primitives = n;
+    return node;
+}
+
+bvh_build_node *make_interior(int axis, bvh_build_node *c0, bvh_build_node *c1)
+{
+    bvh_build_node *node = new bvh_build_node;
+    node->bounds = surrounding_box(c0->bounds, c1->bounds);
+    node->children[0] = c0;
+    node->children[1] = c1;
+    node->split_axis = axis;
+    node->first_prim_offset = c0->first_prim_offset;
+    node->prim_count = c0->prim_count + c1->prim_count;
+    node->n_primitives = 0;
+    return node;
+}
+
+// top down SAH build, partitions p in place so leaves are ranges of base
+bvh_build_node *sweep_sah_build(bvh_primitive *base, bvh_primitive *p, int n, int depth = 0)
+{
+    aabb bounds = p[0].box;
+    for (int i = 1; i < n; i++)
+    {
+        bounds = surrounding_box(bounds, p[i].box);
+    }
+    if (n == 1)
+    {
+        return make_leaf(base, p, n, bounds);
+    }
+
+    int axis;
+    int split;
+    if (depth < bvh_max_sah_depth)
+    {
+        float split_cost;
+        split = sah_sweep_split(p, n, split_cost, &axis);
+        float cost = bvh_traversal_cost + split_cost / bounds.area();
+        if (n <= bvh_max_prims_in_node && cost >= n)
+        {
+            return make_leaf(base, p, n, bounds);
+        }
+    }
+    else
+    {
+        vec3 d = bounds.max() - bounds.min();
+        axis = d.x() > d.y() && d.x() > d.z() ? 0 : (d.y() > d.z() ? 1 : 2);
+        split = n/2;
+        std::nth_element(p, p+split, p+n, bvh_centroid_compare(axis));
+    }
+
+    return make_interior(axis,
+                         sweep_sah_build(base, p, split, depth+1),
+                         sweep_sah_build(base, p+split, n-split, depth+1));
+}
+
+// binned SAH build, parallel over the same threads the renderer uses.
+// each node bins the primitive centroids on every axis and only evaluates
+// splits at bin boundaries, which is O(n) per level instead of a sort.
+static const int bvh_bin_count = 16;
+// nodes smaller than this are not worth handing to another thread
+static const int bvh_min_parallel_prims = 4096;
+// and nodes smaller than this bin on the calling thread only
+static const int bvh_min_parallel_bin_prims = 65536;
+
+struct bvh_bins
+{
+    int count[3][bvh_bin_count];
+    aabb bounds[3][bvh_bin_count];
+};
+
+// maps a centroid to its bin, shared by binning and partitioning so they agree
+inline int bvh_bin_index(float c, float cmin, float scale)
+{
+    int b = int((c - cmin) * scale);
+    if (b < 0) b = 0;
+    if (b >= bvh_bin_count) b = bvh_bin_count-1;
+    return b;
+}
+
+// true for primitives left of the split bin
+struct bvh_bin_below
+{
+    bvh_bin_below(int a, int b, float m, float s) : axis(a), split_bin(b), cmin(m), scale(s) {}
+    bool operator()(const bvh_primitive& prim) const
+    {
+        return bvh_bin_index(prim.centroid[axis], cmin, scale) < split_bin;
+    }
+    int axis, split_bin;
+    float cmin, scale;
+};
+
+// a slice of a node's primitives, processed by one thread
+struct bvh_bin_chunk
+{
+    const bvh_primitive *p;
+    int n;
+    aabb centroid_bounds; // input to the binning pass
+    vec3 scale;
+    aabb bounds; // outputs of the bounds pass
+    aabb centroid_box;
+    bvh_bins bins; // output of the binning pass
+};
+
+void bvh_bounds_chunk(bvh_bin_chunk& chunk)
+{
+    chunk.bounds = chunk.p[0].box;
+    chunk.centroid_box = aabb(chunk.p[0].centroid, chunk.p[0].centroid);
+    for (int i = 1; i < chunk.n; i++)
+    {
+        chunk.bounds = surrounding_box(chunk.bounds, chunk.p[i].box);
+        chunk.centroid_box = surrounding_box(chunk.centroid_box, aabb(chunk.p[i].centroid, chunk.p[i].centroid));
+    }
+}
+
+void bvh_bins_chunk(bvh_bin_chunk& chunk)
+{
+    bvh_bins& bins = chunk.bins;
+    for (int a = 0; a < 3; a++)
+    {
+        for (int b = 0; b < bvh_bin_count; b++)
+        {
+            bins.count[a][b] = 0;
+        }
+    }
+    for (int i = 0; i < chunk.n; i++)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            int b = bvh_bin_index(chunk.p[i].centroid[a], chunk.centroid_bounds.min()[a], chunk.scale[a]);
+            bins.bounds[a][b] = bins.count[a][b]++ ? surrounding_box(bins.bounds[a][b], chunk.p[i].box) : chunk.p[i].box;
+        }
+    }
+}
+
+bvh_build_node *binned_sah_build(bvh_primitive *base, bvh_primitive *p, int n, int threads, int depth = 0);
+
+struct bvh_build_task
+{
+    bvh_primitive *base, *p;
+    int n, threads, depth;
+    bvh_build_node *result;
+};
+
+void *bvh_build_thread(void *arg)
+{
+    bvh_build_task *task = (bvh_build_task *)arg;
+    task->result = binned_sah_build(task->base, task->p, task->n, task->threads, task->depth);
+    return NULL;
+}
+
+bvh_build_node *binned_sah_build(bvh_primitive *base, bvh_primitive *p, int n, int threads, int depth)
+{
+    // split the big top level nodes between threads for the linear passes
+    int chunk_count = n >= bvh_min_parallel_bin_prims && threads > 1 ? threads : 1;
+    bvh_bin_chunk local_chunk;
+    bvh_bin_chunk *chunks = chunk_count > 1 ? new bvh_bin_chunk[chunk_count] : &local_chunk;
+    for (int c = 0; c < chunk_count; c++)
+    {
+        int begin = int((long long)n * c / chunk_count);
+        int end = int((long long)n * (c+1) / chunk_count);
+        chunks[c].p = p + begin;
+        chunks[c].n = end - begin;
+    }
+    // one chunk per thread
+    parallel_for(chunk_count, chunk_count, [&](int begin, int end, int thread) {
+        for (int c = begin; c < end; c++)
+        {
+            bvh_bounds_chunk(chunks[c]);
+        }
+    });
+    aabb bounds = chunks[0].bounds;
+    aabb centroid_bounds = chunks[0].centroid_box;
+    for (int c = 1; c < chunk_count; c++)
+    {
+        bounds = surrounding_box(bounds, chunks[c].bounds);
+        centroid_bounds = surrounding_box(centroid_bounds, chunks[c].centroid_box);
+    }
+    if (n == 1)
+    {
+        if (chunks != &local_chunk) delete [] chunks;
+        return make_leaf(base, p, n, bounds);
+    }
+
+    vec3 extent = centroid_bounds.max() - centroid_bounds.min();
+    vec3 scale;
+    for (int a = 0; a < 3; a++)
+    {
+        scale[a] = extent[a] > 0 ? bvh_bin_count / extent[a] : 0;
+    }
+
+    int axis = -1;
+    int split_bin = 0;
+    float best_cost = MAXFLOAT;
+    if (depth < bvh_max_sah_depth && (extent.x() > 0 || extent.y() > 0 || extent.z() > 0))
+    {
+        for (int c = 0; c < chunk_count; c++)
+        {
+            chunks[c].centroid_bounds = centroid_bounds;
+            chunks[c].scale = scale;
+        }
+        parallel_for(chunk_count, chunk_count, [&](int begin, int end, int thread) {
+            for (int c = begin; c < end; c++)
+            {
+                bvh_bins_chunk(chunks[c]);
+            }
+        });
+        bvh_bins& bins = chunks[0].bins;
+        for (int c = 1; c < chunk_count; c++)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                for (int b = 0; b < bvh_bin_count; b++)
+                {
+                    int count = chunks[c].bins.count[a][b];
+                    if (count == 0) continue;
+                    bins.bounds[a][b] = bins.count[a][b] ? surrounding_box(bins.bounds[a][b], chunks[c].bins.bounds[a][b]) : chunks[c].bins.bounds[a][b];
+                    bins.count[a][b] += count;
+                }
+            }
+        }
+
+        // sweep the bin boundaries of every axis
+        for (int a = 0; a < 3; a++)
+        {
+            if (extent[a] <= 0) continue;
+
+            float right_area[bvh_bin_count];
+            int right_count[bvh_bin_count];
+            aabb acc;
+            int count = 0;
+            for (int b = bvh_bin_count-1; b > 0; b--)
+            {
+                if (bins.count[a][b])
+                {
+                    acc = count ? surrounding_box(acc, bins.bounds[a][b]) : bins.bounds[a][b];
+                    count += bins.count[a][b];
+                }
+                right_area[b] = count ? acc.area() : 0;
+                right_count[b] = count;
+            }
+
+            count = 0;
+            for (int b = 1; b < bvh_bin_count; b++)
+            {
+                if (bins.count[a][b-1])
+                {
+                    acc = count ? surrounding_box(acc, bins.bounds[a][b-1]) : bins.bounds[a][b-1];
+                    count += bins.count[a][b-1];
+                }
+                if (count == 0 || right_count[b] == 0) continue;
+                float cost = acc.area()*count + right_area[b]*right_count[b];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    axis = a;
+                    split_bin = b;
+                }
+            }
+        }
+    }
+    if (chunks != &local_chunk) delete [] chunks;
+
+    int split;
+    if (axis >= 0)
+    {
+        float cost = bvh_traversal_cost + best_cost / bounds.area();
+        if (n <= bvh_max_prims_in_node && cost >= n)
+        {
+            return make_leaf(base, p, n, bounds);
+        }
+        bvh_primitive *mid = std::partition(p, p+n, bvh_bin_below(axis, split_bin, centroid_bounds.min()[axis], scale[axis]));
+        split = int(mid - p);
+    }
+    else
+    {
+        // all centroids coincide, or the tree is too deep: split into equal counts
+        if (n <= bvh_max_prims_in_node)
+        {
+            return make_leaf(base, p, n, bounds);
+        }
+        axis = extent.x() > extent.y() && extent.x() > extent.z() ? 0 : (extent.y() > extent.z() ? 1 : 2);
+        split = n/2;
+        std::nth_element(p, p+split, p+n, bvh_centroid_compare(axis));
+    }
+
+    bvh_build_node *children[2];
+    if (threads > 1 && n >= bvh_min_parallel_prims)
+    {
+        // hand the left side to a new thread and keep building the right one here
+        bvh_build_task left_task = {base, p, split, threads/2, depth+1, NULL};
+        pthread_t thread;
+        int rc = pthread_create(&thread, NULL, bvh_build_thread, (void *)&left_task);
+        children[1] = binned_sah_build(base, p+split, n-split, threads - threads/2, depth+1);
+        if (rc)
+        {
+            bvh_build_thread((void *)&left_task);
+        }
+        else
+        {
+            pthread_join(thread, NULL);
+        }
+        children[0] = left_task.result;
+    }
+    else
+    {
+        children[0] = binned_sah_build(base, p, split, 1, depth+1);
+        children[1] = binned_sah_build(base, p+split, n-split, 1, depth+1);
+    }
+    return make_interior(axis, children[0], children[1]);
+}
+
+// linear BVH (Karras 2012). primitives are sorted along a Morton curve of
+// their centroids and the hierarchy falls out of the common prefixes of
+// neighbouring codes, so every internal node can be emitted independently.
+// much faster than SAH to build, at some cost in tree quality.
+
+// 10 bits per axis, 30 bit codes
+inline unsigned int morton_expand_bits(unsigned int v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 21 bits per axis, 63 bit codes
+inline unsigned long long morton_expand_bits(unsigned long long v)
+{
+    v &= 0x1fffffull;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+// p is in [0,1]^3, x ends up in the highest bit of every triple
+template <class K>
+inline K morton_code(const vec3& p)
+{
+    const float scale = sizeof(K) == 4 ? 1023.0f : 2097151.0f;
+    K x = K(ffmin(ffmax(p.x() * scale, 0.0f), scale));
+    K y = K(ffmin(ffmax(p.y() * scale, 0.0f), scale));
+    K z = K(ffmin(ffmax(p.z() * scale, 0.0f), scale));
+    return (morton_expand_bits(x) << 2) | (morton_expand_bits(y) << 1) | morton_expand_bits(z);
+}
+
+inline int count_leading_zeros(unsigned int v) { return v ? __builtin_clz(v) : 32; }
+inline int count_leading_zeros(unsigned long long v) { return v ? __builtin_clzll(v) : 64; }
+
+// parallel LSD radix sort of (key, value) pairs, 8 bits per pass
+template <class K>
+void radix_sort(K *keys, int *values, int n, int nt)
+{
+    K *keys_tmp = new K[n];
+    int *values_tmp = new int[n];
+    if (nt < 1) nt = 1;
+    int *histogram = new int[nt*256];
+    // every pass scatters from src to dst and then they swap
+    K *src_keys = keys, *dst_keys = keys_tmp;
+    int *src_values = values, *dst_values = values_tmp;
+    for (int shift = 0; shift < int(8*sizeof(K)); shift += 8)
+    {
+        for (int i = 0; i < nt*256; i++)
+        {
+            histogram[i] = 0;
+        }
+        parallel_for(n, nt, [&](int begin, int end, int thread) {
+            int *h = histogram + thread*256;
+            for (int i = begin; i < end; i++)
+            {
+                h[(src_keys[i] >> shift) & 0xff]++;
+            }
+        });
+        // exclusive prefix sum, digit major so equal digits keep thread order (stable)
+        int sum = 0;
+        for (int d = 0; d < 256; d++)
+        {
+            for (int t = 0; t < nt; t++)
+            {
+                int count = histogram[t*256 + d];
+                histogram[t*256 + d] = sum;
+                sum += count;
+            }
+        }
+        parallel_for(n, nt, [&](int begin, int end, int thread) {
+            int *h = histogram + thread*256;
+            for (int i = begin; i < end; i++)
+            {
+                int dst = h[(src_keys[i] >> shift) & 0xff]++;
+                dst_keys[dst] = src_keys[i];
+                dst_values[dst] = src_values[i];
+            }
+        });
+        std::swap(src_keys, dst_keys);
+        std::swap(src_values, dst_values);
+    }
+    // keys with an odd number of bytes end up in the temporaries
+    if (src_keys != keys)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            keys[i] = src_keys[i];
+            values[i] = src_values[i];
+        }
+    }
+    delete [] histogram;
+    delete [] values_tmp;
+    delete [] keys_tmp;
+}
+
+// length of the common prefix of sorted keys i and j, ties broken by index
+template <class K>
+inline int lbvh_delta(const K *keys, int n, int i, int j)
+{
+    if (j < 0 || j >= n) return -1;
+    if (keys[i] == keys[j])
+    {
+        return int(8*sizeof(K)) + count_leading_zeros((unsigned int)(i ^ j));
+    }
+    return count_leading_zeros(keys[i] ^ keys[j]);
+}
+
+// the highest differing bit of two keys tells the split axis, x is the top bit of every triple
+template <class K>
+inline int lbvh_axis(int delta)
+{
+    int bits = int(8*sizeof(K));
+    return delta < bits ? 2 - (bits-1 - delta) % 3 : 0;
+}
+
+// radix tree over the morton sorted primitives. internal node i covers the sorted
+// range [first[i], last[i]], its children below n-1 are internal nodes and the rest
+// are single primitives offset by n-1.
+template <class K>
+struct lbvh_tree
+{
+    bvh_primitive *prims;
+    K *keys;
+    int n;
+    int *first, *last, *child, *axis;
+};
+
+// a node of the tree being emitted: internal node index and the range it covers.
+// ranges past bvh_max_sah_depth have no tree node (-1) and are split at the middle.
+struct lbvh_range
+{
+    int node;
+    int lo, hi;
+};
+
+// sorts prims along the morton curve and builds the radix tree over them
+template <class K>
+void lbvh_build_tree(bvh_primitive *prims, int n, int nt, lbvh_tree<K>& tree)
+{
+    if (nt < 1) nt = 1;
+    tree.prims = prims;
+    tree.n = n;
+
+    // centroid bounds to normalize the codes
+    aabb *thread_bounds = new aabb[nt];
+    parallel_for(n, nt, [&](int begin, int end, int thread) {
+        aabb b(prims[begin].centroid, prims[begin].centroid);
+        for (int i = begin+1; i < end; i++)
+        {
+            b = surrounding_box(b, aabb(prims[i].centroid, prims[i].centroid));
+        }
+        thread_bounds[thread] = b;
+    });
+    aabb centroid_bounds = thread_bounds[0];
+    for (int t = 1; t < nt && t < n; t++)
+    {
+        centroid_bounds = surrounding_box(centroid_bounds, thread_bounds[t]);
+    }
+    delete [] thread_bounds;
+    vec3 cmin = centroid_bounds.min();
+    vec3 extent = centroid_bounds.max() - cmin;
+    vec3 inv_extent(extent.x() > 0 ? 1/extent.x() : 0, extent.y() > 0 ? 1/extent.y() : 0, extent.z() > 0 ? 1/extent.z() : 0);
+
+    K *keys = new K[n];
+    int *order = new int[n];
+    parallel_for(n, nt, [&](int begin, int end, int thread) {
+        for (int i = begin; i < end; i++)
+        {
+            keys[i] = morton_code<K>((prims[i].centroid - cmin) * inv_extent);
+            order[i] = i;
+        }
+    });
+    radix_sort(keys, order, n, nt);
+    tree.keys = keys;
+
+    // put the primitives in curve order, leaves are ranges of it
+    bvh_primitive *sorted = new bvh_primitive[n];
+    parallel_for(n, nt, [&](int begin, int end, int thread) {
+        for (int i = begin; i < end; i++)
+        {
+            sorted[i] = prims[order[i]];
+        }
+    });
+    parallel_for(n, nt, [&](int begin, int end, int thread) {
+        for (int i = begin; i < end; i++)
+        {
+            prims[i] = sorted[i];
+        }
+    });
+    delete [] sorted;
+    delete [] order;
+
+    int *first = tree.first = new int[n-1];
+    int *last = tree.last = new int[n-1];
+    int *child = tree.child = new int[2*(n-1)];
+    int *axis = tree.axis = new int[n-1];
+    parallel_for(n-1, nt, [&](int begin, int end, int thread) {
+        for (int i = begin; i < end; i++)
+        {
+            // direction of the range from the neighbour with the longer common prefix
+            int d = lbvh_delta(keys, n, i, i+1) - lbvh_delta(keys, n, i, i-1) >= 0 ? 1 : -1;
+            int delta_min = lbvh_delta(keys, n, i, i-d);
+            int l_max = 2;
+            while (lbvh_delta(keys, n, i, i + l_max*d) > delta_min)
+            {
+                l_max *= 2;
+            }
+            int l = 0;
+            for (int t = l_max/2; t >= 1; t /= 2)
+            {
+                if (lbvh_delta(keys, n, i, i + (l+t)*d) > delta_min)
+                {
+                    l += t;
+                }
+            }
+            int j = i + l*d;
+
+            // binary search the split, the last key sharing the node's prefix
+            int delta_node = lbvh_delta(keys, n, i, j);
+            int s = 0;
+            int t = l;
+            do
+            {
+                t = (t + 1) / 2;
+                if (lbvh_delta(keys, n, i, i + (s+t)*d) > delta_node)
+                {
+                    s += t;
+                }
+            } while (t > 1);
+            int gamma = i + s*d + (d < 0 ? -1 : 0);
+
+            first[i] = i < j ? i : j;
+            last[i] = i < j ? j : i;
+            child[2*i+0] = first[i] == gamma ? (n-1) + gamma : gamma;
+            child[2*i+1] = last[i] == gamma+1 ? (n-1) + gamma+1 : gamma+1;
+            axis[i] = lbvh_axis<K>(delta_node);
+        }
+    });
+}
+
+template <class K>
+void free_lbvh_tree(lbvh_tree<K>& tree)
+{
+    delete [] tree.axis;
+    delete [] tree.child;
+    delete [] tree.last;
+    delete [] tree.first;
+    delete [] tree.keys;
+}
+
+template <class K>
+inline lbvh_range lbvh_root(const lbvh_tree<K>& tree)
+{
+    lbvh_range root = {tree.n > 1 ? 0 : -1, 0, tree.n-1};
+    return root;
+}
+
+// children of an interior range (more than bvh_max_prims_in_node primitives), returns the split axis
+template <class K>
+inline int lbvh_children(const lbvh_tree<K>& tree, const lbvh_range& r, int depth, lbvh_range c[2])
+{
+    if (r.node < 0 || depth >= bvh_max_sah_depth)
+    {
+        // too deep (or already below that), equal counts keep the rest of the path short
+        int mid = (r.lo + r.hi + 1) / 2;
+        c[0].node = c[1].node = -1;
+        c[0].lo = r.lo;
+        c[0].hi = mid-1;
+        c[1].lo = mid;
+        c[1].hi = r.hi;
+        return lbvh_axis<K>(lbvh_delta(tree.keys, tree.n, mid-1, mid));
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        int node = tree.child[2*r.node+i];
+        if (node >= tree.n-1)
+        {
+            c[i].node = -1;
+            c[i].lo = c[i].hi = node - (tree.n-1);
+        }
+        else
+        {
+            c[i].node = node;
+            c[i].lo = tree.first[node];
+            c[i].hi = tree.last[node];
+        }
+    }
+    return tree.axis[r.node];
+}
+
+template <class K>
+inline aabb lbvh_leaf_bounds(const lbvh_tree<K>& tree, const lbvh_range& r)
+{
+    aabb bounds = tree.prims[r.lo].box;
+    for (int p = r.lo+1; p <= r.hi; p++)
+    {
+        bounds = surrounding_box(bounds, tree.prims[p].box);
+    }
+    return bounds;
+}
+
+// build tree form of the LBVH for the builders' common interface, flattened
+// BVHs get their nodes straight from the radix tree with lbvh_flatten instead
+template <class K>
+bvh_build_node *lbvh_build_nodes(const lbvh_tree<K>& tree, const lbvh_range& r, int depth)
+{
+    int count = r.hi - r.lo + 1;
+    if (count <= bvh_max_prims_in_node)
+    {
+        return make_leaf(tree.prims, tree.prims + r.lo, count, lbvh_leaf_bounds(tree, r));
+    }
+    lbvh_range c[2];
+    int axis = lbvh_children(tree, r, depth, c);
+    bvh_build_node *c0 = lbvh_build_nodes(tree, c[0], depth+1);
+    bvh_build_node *c1 = lbvh_build_nodes(tree, c[1], depth+1);
+    return make_interior(axis, c0, c1);
+}
+
+// 30 bit codes resolve a 1024^3 grid, bigger scenes need the finer 63 bit ones
+inline bool lbvh_narrow_keys(int n)
+{
+    return n <= (1 << 20);
+}
+
+template <class K>
+bvh_build_node *lbvh_build(bvh_primitive *prims, int n, int nt)
+{
+    lbvh_tree<K> tree;
+    lbvh_build_tree(prims, n, nt, tree);
+    bvh_build_node *root = lbvh_build_nodes(tree, lbvh_root(tree), 0);
+    free_lbvh_tree(tree);
+    return root;
+}
+
+// wraps every object with its box, l can be any hitable type
+template <class T>
+bvh_primitive *make_bvh_primitives(T **l, int n, int nt = 1)
+{
+    bvh_primitive *prims = new bvh_primitive[n];
+    parallel_for(n, nt, [&](int begin, int end, int thread) {
+        for (int i = begin; i < end; i++)
+        {
+            prims[i].obj = l[i];
+            prims[i].index = i;
+            l[i]->bounding_box(prims[i].box);
+            prims[i].centroid = prims[i].box.centroid();
+        }
+    });
+    return prims;
+}
+
+// builds the tree over prims with the chosen builder, prims is reordered to match the leaves
+bvh_build_node *build_bvh_tree(bvh_primitive *prims, int n, bvh_builder builder, int nt)
+{
+    if (builder == BVH_SWEEP_SAH)
+    {
+        return sweep_sah_build(prims, prims, n);
+    }
+    if (builder == BVH_LBVH)
+    {
+        if (lbvh_narrow_keys(n))
+        {
+            return lbvh_build<unsigned int>(prims, n, nt);
+        }
+        return lbvh_build<unsigned long long>(prims, n, nt);
+    }
+    return binned_sah_build(prims, prims, n, nt);
+}
+
+int count_nodes(const bvh_build_node *node)
+{
+    if (node->n_primitives > 0) return 1;
+    return 1 + count_nodes(node->children[0]) + count_nodes(node->children[1]);
+}
+
+void free_build_tree(bvh_build_node *node)
+{
+    if (node->n_primitives == 0)
+    {
+        free_build_tree(node->children[0]);
+        free_build_tree(node->children[1]);
+    }
+    delete node;
+}
+
+#endif //BVHBUILDH
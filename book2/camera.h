@@ -2,16 +2,7 @@
 #define CAMERAH
 
 #include "ray.h"
-
-vec3 random_in_unit_disk()
-{
-    vec3 p;
-    do
-    {
-        p = 2.0*vec3(drand48(),drand48(),0) - vec3(1,1,0);
-    } while (dot(p,p) >= 1.0);
-    return p;
-}
+#include "sampler.h"
 
 class camera
 {
@@ -30,9 +21,9 @@ class camera
             horizontal = 2*half_width*focus_dist*u;
             vertical = 2*half_height*focus_dist*v;
         }
-        ray get_ray(float s, float t) 
+        ray get_ray(float s, float t, sampler& rnd) const
         {
-            vec3 rd = lens_radius*random_in_unit_disk();
+            vec3 rd = lens_radius*random_in_unit_disk(rnd);
             vec3 offset = u*rd.x() + v*rd.y();
             return ray(origin + offset, lower_left_corner + s*horizontal + t*vertical - origin - offset); 
         }
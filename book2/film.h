@@ -0,0 +1,141 @@
+#ifndef FILMH
+#define FILMH
+
+#include "ray.h"
+
+inline float luminance(const vec3& c)
+{
+    return 0.2126f*c.r() + 0.7152f*c.g() + 0.0722f*c.b();
+}
+
+// standard error of the mean luminance relative to the mean, from the sum and
+// the sum of squares of n sample luminances. dark pixels are measured against
+// a floor of 0.01 so they do not chase noise nobody can see.
+inline float relative_error(double sum, double sum_sq, int n)
+{
+    if (n < 2) return MAXFLOAT;
+    double mean = sum / n;
+    double variance = (sum_sq - mean*sum) / (n - 1);
+    double error = sqrt((variance > 0 ? variance : 0) / n);
+    return float(error / (mean > 0.01 ? mean : 0.01));
+}
+
+// linear RGB accumulation buffer, one sum, luminance sum of squares and sample
+// count per pixel. pixels are indexed with j going up like the camera. threads add
+// whole tiles, so a pixel is only ever written by one thread at a time and no
+// locking is needed.
+class film
+{
+    public:
+        film(int w, int h);
+        ~film();
+        void add(int i, int j, const vec3& sum, double luminance_sq, int samples);
+        vec3 mean(int i, int j) const;
+        float error(int i, int j) const;
+        float mean_error() const;
+        // gamma 2 and quantize to 8 bit, rows top to bottom for the image writers
+        void write_rgb8(unsigned char *data) const;
+        // samples per pixel as gray levels, max_samples is white
+        void write_counts(unsigned char *data, int max_samples) const;
+
+        int nx, ny;
+        double *sum;
+        double *sum_sq;
+        int *count;
+};
+
+film::film(int w, int h)
+{
+    nx = w;
+    ny = h;
+    sum = new double[nx*ny*3];
+    sum_sq = new double[nx*ny];
+    count = new int[nx*ny];
+    for (int p = 0; p < nx*ny; p++)
+    {
+        sum[3*p+0] = sum[3*p+1] = sum[3*p+2] = 0;
+        sum_sq[p] = 0;
+        count[p] = 0;
+    }
+}
+
+film::~film()
+{
+    delete [] sum;
+    delete [] sum_sq;
+    delete [] count;
+}
+
+inline void film::add(int i, int j, const vec3& s, double luminance_sq, int samples)
+{
+    int p = i + j*nx;
+    sum[3*p+0] += s[0];
+    sum[3*p+1] += s[1];
+    sum[3*p+2] += s[2];
+    sum_sq[p] += luminance_sq;
+    count[p] += samples;
+}
+
+inline vec3 film::mean(int i, int j) const
+{
+    int p = i + j*nx;
+    if (count[p] == 0) return vec3(0,0,0);
+    double inv = 1.0 / count[p];
+    return vec3(sum[3*p+0]*inv, sum[3*p+1]*inv, sum[3*p+2]*inv);
+}
+
+inline float film::error(int i, int j) const
+{
+    int p = i + j*nx;
+    double luminance_sum = 0.2126*sum[3*p+0] + 0.7152*sum[3*p+1] + 0.0722*sum[3*p+2];
+    return relative_error(luminance_sum, sum_sq[p], count[p]);
+}
+
+// average relative error over the pixels that have enough samples to tell
+float film::mean_error() const
+{
+    double total = 0;
+    int pixels = 0;
+    for (int j = 0; j < ny; j++)
+    {
+        for (int i = 0; i < nx; i++)
+        {
+            if (count[i + j*nx] < 2) continue;
+            total += error(i, j);
+            pixels++;
+        }
+    }
+    return pixels > 0 ? float(total / pixels) : MAXFLOAT;
+}
+
+void film::write_rgb8(unsigned char *data) const
+{
+    for (int j = 0; j < ny; j++)
+    {
+        for (int i = 0; i < nx; i++)
+        {
+            vec3 col = mean(i, j);
+            // this fixed a bug in the chapter2 y mapping for the image
+            int pix_id = (i+nx*(ny-1)-j*nx)*3;
+            for (int c = 0; c < 3; c++)
+            {
+                float value = sqrt(col[c] > 0 ? col[c] : 0);
+                data[pix_id+c] = (unsigned char)(255.99*(value < 1 ? value : 1));
+            }
+        }
+    }
+}
+
+void film::write_counts(unsigned char *data, int max_samples) const
+{
+    for (int j = 0; j < ny; j++)
+    {
+        for (int i = 0; i < nx; i++)
+        {
+            int value = 255 * count[i + j*nx] / max_samples;
+            data[i+nx*(ny-1)-j*nx] = (unsigned char)(value < 255 ? value : 255);
+        }
+    }
+}
+
+#endif //FILMH
@@ -2,12 +2,20 @@
 #define HITABLEH
 
 #include "ray.h"
+#include "aabb.h"
+#include "packet.h"
 
 class material;
+class hitable;
 
+// hit() only fills t and which primitive was hit (obj, prim_id and the instance it sits
+// in, if any). the surface fields below them are filled once by finalize_hit.
 struct hit_record
 {
     float t;
+    const hitable *obj;
+    int prim_id;
+    const hitable *inst;
     float u, v;
     vec3 p;
     vec3 normal;
@@ -17,7 +25,47 @@ struct hit_record
 class hitable
 {
     public:
+        virtual ~hitable() {}
         virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
+        virtual bool bounding_box(aabb& box) const = 0;
+        // true if anything lies between t_min and t_max. stops at the first hit and fills
+        // no hit_record, so shadow and visibility rays should use this instead of hit
+        virtual bool occluded(const ray& r, float t_min, float t_max) const
+        {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+        // fills p, normal, u, v and mat_ptr for a hit this object reported
+        virtual void finalize(const ray& r, hit_record& rec) const {}
+        // closest hits of the packet's rays in mask (bit k is ray k) between t_min and
+        // their t_max. returns the rays it hit, their t_max and recs are updated like
+        // hit() would. objects without a packet traversal trace the rays one by one
+        virtual int hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const
+        {
+            int hits = 0;
+            for (int k = 0; k < packet_size; k++)
+            {
+                if (((mask >> k) & 1) && hit(p.get(k), t_min, p.t_max[k], recs[k]))
+                {
+                    p.t_max[k] = recs[k].t;
+                    hits |= 1 << k;
+                }
+            }
+            return hits;
+        }
 };
 
+// computes the surface of the closest hit, call it after hit() returned true
+inline void finalize_hit(const ray& r, hit_record& rec)
+{
+    if (rec.inst)
+    {
+        rec.inst->finalize(r, rec);
+    }
+    else
+    {
+        rec.obj->finalize(r, rec);
+    }
+}
+
 #endif //HITABLEH
\ No newline at end of file
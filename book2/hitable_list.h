@@ -9,25 +9,52 @@ class hitable_list: public hitable
         hitable_list() {}
         hitable_list(hitable **l, int n) {list=l; list_size = n;}
         virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
         hitable **list;
         int list_size;
 };
 
 bool hitable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-    hit_record temp_rec;
+    // hits only write rec when they are closer, so no temporary record is needed
     bool hit_anything = false;
     double closest_so_far = t_max;
     for (int i = 0; i < list_size; i++)
     {
-        if (list[i]->hit(r, t_min, closest_so_far, temp_rec))
+        if (list[i]->hit(r, t_min, closest_so_far, rec))
         {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = rec.t;
         }
     }
     return hit_anything;
 }
 
+bool hitable_list::occluded(const ray& r, float t_min, float t_max) const
+{
+    for (int i = 0; i < list_size; i++)
+    {
+        if (list[i]->occluded(r, t_min, t_max))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool hitable_list::bounding_box(aabb& box) const
+{
+    if (list_size < 1) return false;
+    aabb temp_box;
+    if (!list[0]->bounding_box(temp_box)) return false;
+    box = temp_box;
+    for (int i = 1; i < list_size; i++)
+    {
+        if (!list[i]->bounding_box(temp_box)) return false;
+        box = surrounding_box(box, temp_box);
+    }
+    return true;
+}
+
 #endif // HITABLELISTH
\ No newline at end of file
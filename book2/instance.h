@@ -0,0 +1,302 @@
+#ifndef INSTANCEH
+#define INSTANCEH
+
+#include "linear_bvh.h"
+
+// 3x4 affine transform, the last column is the translation
+class affine
+{
+    public:
+        affine()
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                for (int j = 0; j < 4; j++)
+                {
+                    m[i][j] = i == j ? 1.0f : 0.0f;
+                }
+            }
+        }
+        vec3 point(const vec3& p) const
+        {
+            return vec3(m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+                        m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+                        m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+        }
+        vec3 vector(const vec3& v) const
+        {
+            return vec3(m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+                        m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+                        m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+        }
+        // multiplies by the transposed 3x3, called on the inverse this moves normals
+        vec3 transpose_vector(const vec3& v) const
+        {
+            return vec3(m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+                        m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+                        m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z());
+        }
+        affine inverse() const;
+        aabb transform_box(const aabb& box) const;
+
+        float m[3][4];
+};
+
+// a*b applies b first
+affine operator*(const affine& a, const affine& b)
+{
+    affine r;
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            r.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j] + (j == 3 ? a.m[i][3] : 0.0f);
+        }
+    }
+    return r;
+}
+
+affine translation(const vec3& t)
+{
+    affine r;
+    r.m[0][3] = t.x();
+    r.m[1][3] = t.y();
+    r.m[2][3] = t.z();
+    return r;
+}
+
+affine scaling(const vec3& s)
+{
+    affine r;
+    r.m[0][0] = s.x();
+    r.m[1][1] = s.y();
+    r.m[2][2] = s.z();
+    return r;
+}
+
+affine rotation_y(float angle)
+{
+    float radians = (M_PI / 180.) * angle;
+    affine r;
+    r.m[0][0] = cos(radians);
+    r.m[0][2] = sin(radians);
+    r.m[2][0] = -sin(radians);
+    r.m[2][2] = cos(radians);
+    return r;
+}
+
+affine affine::inverse() const
+{
+    // inverse of the 3x3 from its cofactors, then the translation goes back through it
+    float c00 = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+    float c01 = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+    float c02 = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+    float inv_det = 1.0f / (m[0][0]*c00 + m[0][1]*c01 + m[0][2]*c02);
+    affine r;
+    r.m[0][0] = c00 * inv_det;
+    r.m[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inv_det;
+    r.m[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+    r.m[1][0] = c01 * inv_det;
+    r.m[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+    r.m[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inv_det;
+    r.m[2][0] = c02 * inv_det;
+    r.m[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inv_det;
+    r.m[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+    vec3 t = r.vector(vec3(m[0][3], m[1][3], m[2][3]));
+    r.m[0][3] = -t.x();
+    r.m[1][3] = -t.y();
+    r.m[2][3] = -t.z();
+    return r;
+}
+
+// box around the 8 transformed corners
+aabb affine::transform_box(const aabb& box) const
+{
+    vec3 corner = point(box.min());
+    aabb r(corner, corner);
+    for (int i = 1; i < 8; i++)
+    {
+        vec3 c((i & 1) ? box.max().x() : box.min().x(),
+               (i & 2) ? box.max().y() : box.min().y(),
+               (i & 4) ? box.max().z() : box.min().z());
+        corner = point(c);
+        r = surrounding_box(r, aabb(corner, corner));
+    }
+    return r;
+}
+
+// places a shared object (usually a bottom level BVH) in the scene without copying it.
+// the ray is moved into object space instead, its direction is not normalized so t
+// is the same in both spaces. if mat_override is set it replaces the object's materials.
+// instances are not nested, the object itself should not contain instances.
+class instance : public hitable
+{
+    public:
+        instance() {}
+        instance(hitable *o, const affine& xf, material *m = NULL)
+            : object(o), to_world(xf), to_object(xf.inverse()), mat_override(m) {}
+        virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual void finalize(const ray& r, hit_record& rec) const;
+        virtual int hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const;
+
+        hitable *object;
+        affine to_world;
+        affine to_object;
+        material *mat_override;
+};
+
+bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    ray local(to_object.point(r.origin()), to_object.vector(r.direction()));
+    if (!object->hit(local, t_min, t_max, rec))
+    {
+        return false;
+    }
+    // rec.obj still points into the object, finalize goes through here first
+    rec.inst = this;
+    return true;
+}
+
+void instance::finalize(const ray& r, hit_record& rec) const
+{
+    rec.obj->finalize(ray(to_object.point(r.origin()), to_object.vector(r.direction())), rec);
+    rec.p = r.point_at_parameter(rec.t);
+    // normals move with the inverse transpose, scaling can change their length
+    rec.normal = unit_vector(to_object.transpose_vector(rec.normal));
+    if (mat_override)
+    {
+        rec.mat_ptr = mat_override;
+    }
+}
+
+bool instance::occluded(const ray& r, float t_min, float t_max) const
+{
+    return object->occluded(ray(to_object.point(r.origin()), to_object.vector(r.direction())), t_min, t_max);
+}
+
+// the whole packet moves into object space, an affine map keeps it coherent
+int instance::hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const
+{
+    ray_packet local;
+    for (int k = 0; k < packet_size; k++)
+    {
+        vec3 o(p.org[0][k], p.org[1][k], p.org[2][k]);
+        vec3 d(p.dir[0][k], p.dir[1][k], p.dir[2][k]);
+        local.set(k, ray(to_object.point(o), to_object.vector(d)));
+        local.t_max[k] = p.t_max[k];
+    }
+    int hits = object->hit_packet(local, mask, t_min, recs);
+    for (int k = 0; k < packet_size; k++)
+    {
+        if ((hits >> k) & 1)
+        {
+            p.t_max[k] = local.t_max[k];
+            recs[k].inst = this;
+        }
+    }
+    return hits;
+}
+
+bool instance::bounding_box(aabb& box) const
+{
+    aabb object_box;
+    if (!object->bounding_box(object_box))
+    {
+        return false;
+    }
+    box = to_world.transform_box(object_box);
+    return true;
+}
+
+// top level BVH over instances, same flattened layout and traversal as linear_bvh
+// but the leaves hold instance pointers. memory grows with the instance count
+// (one small instance and about two nodes each), the geometry is stored once.
+class instance_bvh : public hitable
+{
+    public:
+        instance_bvh() {}
+        instance_bvh(instance **l, int n, bvh_builder builder = BVH_BINNED_SAH, int nt = 1);
+        virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual int hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const;
+
+        linear_bvh_node *nodes;
+        int node_count;
+        // leaves are ranges of this
+        instance **instances;
+        int instance_count;
+};
+
+instance_bvh::instance_bvh(instance **l, int n, bvh_builder builder, int nt)
+{
+    bvh_primitive *prims = make_bvh_primitives(l, n, nt);
+    nodes = build_linear_bvh_nodes(prims, n, builder, nt, node_count);
+    instances = new instance*[n];
+    instance_count = n;
+    for (int i = 0; i < n; i++)
+    {
+        instances[i] = l[prims[i].index];
+    }
+    delete [] prims;
+}
+
+bool instance_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    bool hit_anything = false;
+    traverse_ray(nodes, r, t_min, t_max, true, [&](const linear_bvh_node& node, float& t_max) {
+        for (int i = node.primitives_offset; i < node.primitives_offset + node.n_primitives; i++)
+        {
+            if (instances[i]->instance::hit(r, t_min, t_max, rec))
+            {
+                hit_anything = true;
+                t_max = rec.t;
+            }
+        }
+        return false;
+    });
+    return hit_anything;
+}
+
+// same packet traversal as linear_bvh, leaves pass the packet to their instances
+int instance_bvh::hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const
+{
+    p.prepare();
+    if (!p.coherent)
+    {
+        return hitable::hit_packet(p, mask, t_min, recs);
+    }
+    return traverse_packet(nodes, p, mask, t_min, [&](const linear_bvh_node& node, int active) {
+        int hits = 0;
+        for (int i = node.primitives_offset; i < node.primitives_offset + node.n_primitives; i++)
+        {
+            hits |= instances[i]->instance::hit_packet(p, active, t_min, recs);
+        }
+        return hits;
+    });
+}
+
+bool instance_bvh::occluded(const ray& r, float t_min, float t_max) const
+{
+    return traverse_ray(nodes, r, t_min, t_max, false, [&](const linear_bvh_node& node, float& t_max) {
+        for (int i = node.primitives_offset; i < node.primitives_offset + node.n_primitives; i++)
+        {
+            if (instances[i]->instance::occluded(r, t_min, t_max))
+            {
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+bool instance_bvh::bounding_box(aabb& box) const
+{
+    box = aabb(vec3(nodes[0].bounds[0][0], nodes[0].bounds[0][1], nodes[0].bounds[0][2]),
+               vec3(nodes[0].bounds[1][0], nodes[0].bounds[1][1], nodes[0].bounds[1][2]));
+    return true;
+}
+
+#endif //INSTANCEH
@@ -0,0 +1,307 @@
+#ifndef LIGHTBVHH
+#define LIGHTBVHH
+
+#include <stdint.h>
+#include "lights.h"
+#include "bvh_build.h"
+
+// bounds of a group of lights: where they are, how much they emit and which way.
+// every emission direction is within theta_o of axis, and leaves the surface at
+// up to theta_e from it. spheres emit everywhere (theta_o = pi, theta_e = pi/2).
+struct light_bounds
+{
+    aabb box;
+    vec3 axis;
+    float cos_theta_o;
+    float cos_theta_e;
+    float power;
+};
+
+// depth limit of the hierarchy, one bit of a light's trail per level
+const int light_trail_bits = 64;
+
+// flattened like linear_bvh, the first child follows its parent
+struct light_bvh_node
+{
+    light_bounds bounds;
+    int offset;      // second child (interior) or first light in leaf order (leaf)
+    int light_count; // 0 for interior nodes
+};
+
+inline float safe_acos(float x)
+{
+    return acos(ffmin(1.0f, ffmax(-1.0f, x)));
+}
+
+// smallest cone around two cones
+inline void cone_union(const vec3& wa, float cos_a, const vec3& wb, float cos_b, vec3& w, float& cos_theta)
+{
+    float theta_a = safe_acos(cos_a);
+    float theta_b = safe_acos(cos_b);
+    float theta_d = safe_acos(dot(wa, wb));
+    if (ffmin(theta_d + theta_b, M_PI) <= theta_a)
+    {
+        w = wa;
+        cos_theta = cos_a;
+        return;
+    }
+    if (ffmin(theta_d + theta_a, M_PI) <= theta_b)
+    {
+        w = wb;
+        cos_theta = cos_b;
+        return;
+    }
+    float theta_o = (theta_a + theta_d + theta_b) / 2;
+    vec3 wr = cross(wa, wb);
+    if (theta_o >= M_PI || wr.squared_length() == 0)
+    {
+        w = wa;
+        cos_theta = -1;
+        return;
+    }
+    // turn wa toward wb by theta_o - theta_a (rodrigues)
+    float theta_r = theta_o - theta_a;
+    wr = unit_vector(wr);
+    w = wa*cos(theta_r) + cross(wr, wa)*sin(theta_r) + wr*dot(wr, wa)*(1 - cos(theta_r));
+    cos_theta = cos(theta_o);
+}
+
+light_bounds bounds_union(const light_bounds& a, const light_bounds& b)
+{
+    if (a.power == 0) return b;
+    if (b.power == 0) return a;
+    light_bounds r;
+    r.box = surrounding_box(a.box, b.box);
+    cone_union(a.axis, a.cos_theta_o, b.axis, b.cos_theta_o, r.axis, r.cos_theta_o);
+    r.cos_theta_e = ffmin(a.cos_theta_e, b.cos_theta_e);
+    r.power = a.power + b.power;
+    return r;
+}
+
+light_bounds sphere_light_bounds(const sphere_light& l)
+{
+    light_bounds b;
+    vec3 r(l.radius, l.radius, l.radius);
+    b.box = aabb(l.center - r, l.center + r);
+    b.axis = vec3(0,0,1);
+    b.cos_theta_o = -1;
+    b.cos_theta_e = 0;
+    // textures may vary, the emission at one point stands in for the whole sphere.
+    // kept above 0 so no light that could emit ends up with probability 0
+    vec3 e = l.mat->emitted(0.5, 0.5, l.center + vec3(0, l.radius, 0));
+    float luminance = 0.2126f*e.r() + 0.7152f*e.g() + 0.0722f*e.b();
+    b.power = ffmax(luminance, 1e-6f) * float(M_PI) * 4.0f*float(M_PI)*l.radius*l.radius;
+    return b;
+}
+
+// estimate of how much the lights in b give to a point p with normal n (pbrt's light
+// bounds importance). it is 0 only when no light in b can reach p from above n.
+float light_importance(const light_bounds& b, const vec3& p, const vec3& n)
+{
+    vec3 pc = b.box.centroid();
+    float dist2 = (p - pc).squared_length();
+    float diag = (b.box.max() - b.box.min()).length();
+    // do not let close or big groups blow up
+    float d2 = ffmax(dist2, diag / 2);
+    float r2 = diag*diag / 4;
+    if (dist2 <= r2)
+    {
+        // inside the bounding sphere every direction is possible
+        return b.power / d2;
+    }
+    // half angle of the bounding sphere seen from p
+    float theta_b = asin(sqrt(r2 / dist2));
+    vec3 wi = (p - pc) / sqrt(dist2);
+    float theta_w = safe_acos(dot(b.axis, wi));
+    float theta_p = ffmax(0.0f, theta_w - safe_acos(b.cos_theta_o) - theta_b);
+    if (theta_p >= safe_acos(b.cos_theta_e))
+    {
+        return 0;
+    }
+    float importance = b.power * cos(theta_p) / d2;
+    // lights that are all below the surface give nothing
+    float theta_i = ffmax(0.0f, safe_acos(dot(n, -wi)) - theta_b);
+    return theta_i >= M_PI/2 ? 0 : importance * cos(theta_i);
+}
+
+// light hierarchy, a light is picked by walking down and choosing each child with
+// probability proportional to its importance for the shading point. the probability
+// of any light can be recomputed from its path, which MIS needs for lights hit by chance.
+class light_bvh : public light_sampler
+{
+    public:
+        light_bvh(const light_list *l, int nt = 1);
+        virtual int sample(const vec3& p, const vec3& n, sampler& rnd, float& prob) const;
+        virtual float probability(const vec3& p, const vec3& n, int light) const;
+        virtual int find(const hit_record& rec) const;
+        virtual const sphere_light& light(int i) const { return list->lights[i]; }
+        int flatten(const bvh_build_node *node, uint64_t trail, int depth);
+        float leaf_probability(const light_bvh_node& node, const vec3& p, const vec3& n, int light) const;
+
+        const light_list *list;
+        std::vector<light_bvh_node> nodes;
+        std::vector<light_bounds> light_data;
+        // light indices in leaf order
+        std::vector<int> order;
+        // leaf of every light and the path to it, bit d set means second child at depth d
+        std::vector<int> leaf;
+        std::vector<uint64_t> trail;
+};
+
+light_bvh::light_bvh(const light_list *l, int nt)
+{
+    list = l;
+    int n = int(list->lights.size());
+    if (n == 0) return;
+    light_data.resize(n);
+    leaf.resize(n);
+    trail.resize(n);
+    order.resize(n);
+    bvh_primitive *prims = new bvh_primitive[n];
+    for (int i = 0; i < n; i++)
+    {
+        light_data[i] = sphere_light_bounds(list->lights[i]);
+        prims[i].obj = NULL;
+        prims[i].index = i;
+        prims[i].box = light_data[i].box;
+        prims[i].centroid = prims[i].box.centroid();
+    }
+    // the surface area heuristic only looks at the boxes, power and cones are
+    // only used for sampling. flatten() turns subtrees deeper than the trail into leaves
+    bvh_build_node *root = build_bvh_tree(prims, n, BVH_BINNED_SAH, nt);
+    for (int i = 0; i < n; i++)
+    {
+        order[i] = prims[i].index;
+    }
+    flatten(root, 0, 0);
+    free_build_tree(root);
+    delete [] prims;
+}
+
+// a subtree that would go deeper than the trail has bits becomes one leaf
+int light_bvh::flatten(const bvh_build_node *node, uint64_t path, int depth)
+{
+    int index = int(nodes.size());
+    nodes.push_back(light_bvh_node());
+    if (node->n_primitives > 0 || depth == light_trail_bits)
+    {
+        light_bounds b;
+        b.power = 0;
+        for (int i = node->first_prim_offset; i < node->first_prim_offset + node->prim_count; i++)
+        {
+            b = bounds_union(b, light_data[order[i]]);
+            leaf[order[i]] = index;
+            trail[order[i]] = path;
+        }
+        nodes[index].bounds = b;
+        nodes[index].offset = node->first_prim_offset;
+        nodes[index].light_count = node->prim_count;
+        return index;
+    }
+    flatten(node->children[0], path, depth+1);
+    int second = flatten(node->children[1], path | (uint64_t(1) << depth), depth+1);
+    nodes[index].bounds = bounds_union(nodes[index+1].bounds, nodes[second].bounds);
+    nodes[index].offset = second;
+    nodes[index].light_count = 0;
+    return index;
+}
+
+// probability of picking light among the lights of a leaf
+float light_bvh::leaf_probability(const light_bvh_node& node, const vec3& p, const vec3& n, int light) const
+{
+    float total = 0;
+    float own = 0;
+    for (int i = node.offset; i < node.offset + node.light_count; i++)
+    {
+        float importance = light_importance(light_data[order[i]], p, n);
+        total += importance;
+        if (order[i] == light) own = importance;
+    }
+    return total > 0 ? own / total : 0;
+}
+
+int light_bvh::sample(const vec3& p, const vec3& n, sampler& rnd, float& prob) const
+{
+    if (nodes.empty()) return -1;
+    // one random number, rescaled at every choice
+    float u = rnd.next_float();
+    prob = 1;
+    int current = 0;
+    while (nodes[current].light_count == 0)
+    {
+        const light_bvh_node& node = nodes[current];
+        float i0 = light_importance(nodes[current+1].bounds, p, n);
+        float i1 = light_importance(nodes[node.offset].bounds, p, n);
+        if (i0 + i1 == 0) return -1;
+        float p0 = i0 / (i0 + i1);
+        if (u < p0)
+        {
+            u = ffmin(u / p0, 0.99999994f);
+            prob *= p0;
+            current = current + 1;
+        }
+        else
+        {
+            u = ffmin((u - p0) / (1 - p0), 0.99999994f);
+            prob *= 1 - p0;
+            current = node.offset;
+        }
+    }
+
+    const light_bvh_node& node = nodes[current];
+    float total = 0;
+    for (int i = node.offset; i < node.offset + node.light_count; i++)
+    {
+        total += light_importance(light_data[order[i]], p, n);
+    }
+    if (total == 0) return -1;
+    float target = u * total;
+    float sum = 0;
+    int last = -1;
+    for (int i = node.offset; i < node.offset + node.light_count; i++)
+    {
+        float importance = light_importance(light_data[order[i]], p, n);
+        if (importance == 0) continue;
+        last = i;
+        sum += importance;
+        if (target < sum) break;
+    }
+    prob *= light_importance(light_data[order[last]], p, n) / total;
+    return order[last];
+}
+
+// follows the light's path from the root, taking the same probabilities sample() would
+float light_bvh::probability(const vec3& p, const vec3& n, int light) const
+{
+    uint64_t path = trail[light];
+    float prob = 1;
+    int current = 0;
+    int depth = 0;
+    while (nodes[current].light_count == 0)
+    {
+        const light_bvh_node& node = nodes[current];
+        float i0 = light_importance(nodes[current+1].bounds, p, n);
+        float i1 = light_importance(nodes[node.offset].bounds, p, n);
+        if (i0 + i1 == 0) return 0;
+        if ((path >> depth) & 1)
+        {
+            prob *= i1 / (i0 + i1);
+            current = node.offset;
+        }
+        else
+        {
+            prob *= i0 / (i0 + i1);
+            current = current + 1;
+        }
+        depth++;
+    }
+    return prob * leaf_probability(nodes[current], p, n, light);
+}
+
+// lights keep the list's indices
+int light_bvh::find(const hit_record& rec) const
+{
+    return list->find(rec);
+}
+
+#endif //LIGHTBVHH
@@ -0,0 +1,236 @@
+#ifndef LIGHTSH
+#define LIGHTSH
+
+#include <vector>
+#include <map>
+#include "sphere.h"
+#include "hitable_list.h"
+#include "instance.h"
+#include "wide_bvh.h"
+#include "material.h"
+
+// emissive sphere in world space
+struct sphere_light
+{
+    vec3 center;
+    float radius;
+    material *mat;
+};
+
+// 1 - cos of the half angle of the cone the light fills as seen from p,
+// written so it stays accurate for small far away lights. 2 if p is inside.
+inline float sphere_light_cone(const sphere_light& l, const vec3& p)
+{
+    float d2 = (l.center - p).squared_length();
+    float r2 = l.radius*l.radius;
+    if (d2 <= r2) return 2.0f;
+    float s = r2 / d2;
+    return s / (1.0f + sqrt(1.0f - s));
+}
+
+// density per solid angle of sample_sphere_light picking a direction toward l from p
+inline float sphere_light_pdf(const sphere_light& l, const vec3& p)
+{
+    return 1.0f / (2.0f*float(M_PI)*sphere_light_cone(l, p));
+}
+
+// picks a direction uniformly inside the cone the light fills (the whole sphere of
+// directions if p is inside it) and returns how far along it the light's surface is
+inline vec3 sample_sphere_light(const sphere_light& l, const vec3& p, sampler& rnd, float& dist)
+{
+    vec3 to_center = l.center - p;
+    float d = to_center.length();
+    float z = 1.0f - rnd.next_float()*sphere_light_cone(l, p);
+    float phi = 2.0f*float(M_PI)*rnd.next_float();
+    float sin_theta = sqrt(ffmax(0.0f, 1.0f - z*z));
+    vec3 dir = from_local(to_center / d, vec3(cos(phi)*sin_theta, sin(phi)*sin_theta, z));
+
+    // nearest root in front, the far one from inside
+    float b = dot(to_center, dir);
+    float c = d*d - l.radius*l.radius;
+    float root = sqrt(ffmax(0.0f, b*b - c));
+    dist = c > 0 ? b - root : b + root;
+    return dir;
+}
+
+// power heuristic weight for a sample from the technique with density pdf_a
+inline float mis_weight(float pdf_a, float pdf_b)
+{
+    return pdf_a*pdf_a / (pdf_a*pdf_a + pdf_b*pdf_b);
+}
+
+// chooses which light to sample from a shading point p with normal n
+class light_sampler
+{
+    public:
+        // index of the light to sample from p (-1 if there are none) and its probability
+        virtual int sample(const vec3& p, const vec3& n, sampler& rnd, float& prob) const = 0;
+        virtual float probability(const vec3& p, const vec3& n, int light) const = 0;
+        // the light rec hit, -1 if none
+        virtual int find(const hit_record& rec) const = 0;
+        virtual const sphere_light& light(int i) const = 0;
+};
+
+// true if xf keeps spheres spheres: rotation, uniform scale and translation only
+inline bool keeps_spheres(const affine& xf)
+{
+    vec3 c[3] = {xf.vector(vec3(1,0,0)), xf.vector(vec3(0,1,0)), xf.vector(vec3(0,0,1))};
+    float s = c[0].squared_length();
+    float eps = 1e-4f*s;
+    return fabs(c[1].squared_length() - s) <= eps && fabs(c[2].squared_length() - s) <= eps &&
+           fabs(dot(c[0], c[1])) <= eps && fabs(dot(c[1], c[2])) <= eps && fabs(dot(c[2], c[0])) <= eps;
+}
+
+// every emissive sphere of the scene, picked uniformly for light sampling
+class light_list : public light_sampler
+{
+    public:
+        light_list() {}
+        void add(const hitable *h);
+        void add_sphere(const vec3& center, float radius, material *mat, const hitable *obj, int prim_id);
+        virtual int sample(const vec3& p, const vec3& n, sampler& rnd, float& prob) const;
+        virtual float probability(const vec3& p, const vec3& n, int light) const;
+        virtual int find(const hit_record& rec) const;
+        virtual const sphere_light& light(int i) const { return lights[i]; }
+
+        std::vector<sphere_light> lights;
+        // light of every emissive primitive, keyed the way hits name them: the
+        // instance (rec.inst) or the object and primitive (rec.obj, rec.prim_id)
+        std::map<std::pair<const hitable *, int>, int> ids;
+};
+
+// adds the emissive spheres in h, h can be the world or any part of it. instances of a
+// sphere are added if they keep it a sphere, a light sampled as the wrong shape would
+// bias the image, so stretched ones are only found by BSDF sampling
+void light_list::add(const hitable *h)
+{
+    if (const sphere *s = dynamic_cast<const sphere *>(h))
+    {
+        add_sphere(s->center, s->radius, s->mat_ptr, s, 0);
+    }
+    else if (const instance *in = dynamic_cast<const instance *>(h))
+    {
+        const sphere *s = dynamic_cast<const sphere *>(in->object);
+        if (s && keeps_spheres(in->to_world))
+        {
+            float scale = in->to_world.vector(vec3(1,0,0)).length();
+            add_sphere(in->to_world.point(s->center), s->radius * scale, in->mat_override ? in->mat_override : s->mat_ptr, in, 0);
+        }
+    }
+    else if (const sphere_soa *soa = dynamic_cast<const sphere_soa *>(h))
+    {
+        for (int i = 0; i < soa->count; i++)
+        {
+            vec3 center(soa->center_x[i], soa->center_y[i], soa->center_z[i]);
+            add_sphere(center, soa->radius[i], soa->materials[soa->material_index[i]], soa, i);
+        }
+    }
+    else if (const linear_bvh *bvh = dynamic_cast<const linear_bvh *>(h))
+    {
+        add(bvh->spheres);
+    }
+    else if (const wide_bvh<4> *bvh = dynamic_cast<const wide_bvh<4> *>(h))
+    {
+        for (int i = 0; i < bvh->sphere_count; i++)
+        {
+            add_sphere(bvh->spheres[i].center, bvh->spheres[i].radius, bvh->spheres[i].mat_ptr, bvh, i);
+        }
+    }
+    else if (const wide_bvh<8> *bvh = dynamic_cast<const wide_bvh<8> *>(h))
+    {
+        for (int i = 0; i < bvh->sphere_count; i++)
+        {
+            add_sphere(bvh->spheres[i].center, bvh->spheres[i].radius, bvh->spheres[i].mat_ptr, bvh, i);
+        }
+    }
+    else if (const instance_bvh *bvh = dynamic_cast<const instance_bvh *>(h))
+    {
+        for (int i = 0; i < bvh->instance_count; i++)
+        {
+            add(bvh->instances[i]);
+        }
+    }
+    else if (const hitable_list *list = dynamic_cast<const hitable_list *>(h))
+    {
+        for (int i = 0; i < list->list_size; i++)
+        {
+            add(list->list[i]);
+        }
+    }
+    else if (const bvh_node *node = dynamic_cast<const bvh_node *>(h))
+    {
+        add(node->left);
+        // a node over one object holds it twice
+        if (node->right != node->left)
+        {
+            add(node->right);
+        }
+    }
+}
+
+void light_list::add_sphere(const vec3& center, float radius, material *mat, const hitable *obj, int prim_id)
+{
+    if (!mat || !mat->is_emissive())
+    {
+        return;
+    }
+    ids[std::make_pair(obj, prim_id)] = int(lights.size());
+    sphere_light l;
+    l.center = center;
+    l.radius = fabs(radius);
+    l.mat = mat;
+    lights.push_back(l);
+}
+
+int light_list::sample(const vec3& p, const vec3& n, sampler& rnd, float& prob) const
+{
+    int count = int(lights.size());
+    if (count == 0) return -1;
+    prob = 1.0f / count;
+    int i = int(rnd.next_float() * count);
+    return i < count ? i : count-1;
+}
+
+float light_list::probability(const vec3& p, const vec3& n, int light) const
+{
+    return 1.0f / lights.size();
+}
+
+int light_list::find(const hit_record& rec) const
+{
+    std::map<std::pair<const hitable *, int>, int>::const_iterator it =
+        rec.inst ? ids.find(std::make_pair(rec.inst, 0)) : ids.find(std::make_pair(rec.obj, rec.prim_id));
+    return it == ids.end() ? -1 : it->second;
+}
+
+// light sampling at a diffuse hit: one light is picked and a direction toward it is
+// sampled, weighted against the BSDF sampling that could have found the same light
+// with multiple importance sampling. returns false if there is nothing to add, else
+// the shadow ray, the distance to the light along it and what it adds if unoccluded.
+// the caller traces the shadow ray, right away or batched with others
+bool sample_light(const ray& r, const hit_record& rec, const vec3& attenuation, const light_sampler& lights, int depth, sampler& rnd,
+                  ray& shadow, float& dist, vec3& contribution)
+{
+    float light_prob;
+    rnd.start_dimensions(bounce_dimension(depth, light_pick_dimension), 1);
+    int i = lights.sample(rec.p, rec.normal, rnd, light_prob);
+    if (i < 0) return false;
+    const sphere_light& l = lights.light(i);
+    rnd.start_dimensions(bounce_dimension(depth, light_dimension), 2);
+    vec3 dir = sample_sphere_light(l, rec.p, rnd, dist);
+    shadow = ray(rec.p, dir);
+    float scattering_pdf = rec.mat_ptr->scattering_pdf(r, rec, shadow);
+    if (scattering_pdf <= 0)
+    {
+        return false;
+    }
+    vec3 q = shadow.point_at_parameter(dist);
+    float u, v;
+    get_sphere_uv((q - l.center) / l.radius, u, v);
+    float light_pdf = light_prob * sphere_light_pdf(l, rec.p);
+    // attenuation*scattering_pdf is the BSDF times the cosine
+    contribution = attenuation*scattering_pdf*l.mat->emitted(u, v, q) * (mis_weight(light_pdf, scattering_pdf) / light_pdf);
+    return true;
+}
+
+#endif //LIGHTSH
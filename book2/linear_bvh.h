@@ -0,0 +1,551 @@
+#ifndef LINEARBVHH
+#define LINEARBVHH
+
+#include <vector>
+#include "bvh_build.h"
+#include "sphere_soa.h"
+
+// 32 byte node in depth first order, the first child of an interior
+// node directly follows it and the second is at second_child_offset
+struct alignas(32) linear_bvh_node
+{
+    float bounds[2][3];
+    union
+    {
+        int primitives_offset;  // leaf
+        int second_child_offset; // interior
+    };
+    unsigned short n_primitives; // 0 for interior nodes
+    unsigned char axis;
+    unsigned char pad;
+};
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should be 32 bytes");
+
+inline void set_node_bounds(linear_bvh_node& node, const aabb& box)
+{
+    for (int a = 0; a < 3; a++)
+    {
+        node.bounds[0][a] = box.min()[a];
+        node.bounds[1][a] = box.max()[a];
+    }
+}
+
+inline void merge_node_bounds(linear_bvh_node& node, const linear_bvh_node& c0, const linear_bvh_node& c1)
+{
+    for (int a = 0; a < 3; a++)
+    {
+        node.bounds[0][a] = ffmin(c0.bounds[0][a], c1.bounds[0][a]);
+        node.bounds[1][a] = ffmax(c0.bounds[1][a], c1.bounds[1][a]);
+    }
+}
+
+int flatten_bvh(const bvh_build_node *node, linear_bvh_node *nodes, int& offset)
+{
+    linear_bvh_node& linear_node = nodes[offset];
+    set_node_bounds(linear_node, node->bounds);
+    linear_node.pad = 0;
+    int my_offset = offset++;
+    if (node->n_primitives > 0)
+    {
+        linear_node.primitives_offset = node->first_prim_offset;
+        linear_node.n_primitives = node->n_primitives;
+        linear_node.axis = 0;
+    }
+    else
+    {
+        linear_node.axis = node->split_axis;
+        linear_node.n_primitives = 0;
+        flatten_bvh(node->children[0], nodes, offset);
+        linear_node.second_child_offset = flatten_bvh(node->children[1], nodes, offset);
+    }
+    return my_offset;
+}
+
+// writes the LBVH subtree of r depth first from nodes[offset] on, returns the offset after it
+template <class K>
+int lbvh_emit(const lbvh_tree<K>& tree, const lbvh_range& r, int depth, linear_bvh_node *nodes, int offset)
+{
+    linear_bvh_node& node = nodes[offset];
+    node.pad = 0;
+    int count = r.hi - r.lo + 1;
+    if (count <= bvh_max_prims_in_node)
+    {
+        set_node_bounds(node, lbvh_leaf_bounds(tree, r));
+        node.primitives_offset = r.lo;
+        node.n_primitives = count;
+        node.axis = 0;
+        return offset + 1;
+    }
+    lbvh_range c[2];
+    node.axis = lbvh_children(tree, r, depth, c);
+    node.n_primitives = 0;
+    node.second_child_offset = lbvh_emit(tree, c[0], depth+1, nodes, offset+1);
+    int end = lbvh_emit(tree, c[1], depth+1, nodes, node.second_child_offset);
+    merge_node_bounds(node, nodes[offset+1], nodes[node.second_child_offset]);
+    return end;
+}
+
+// number of nodes lbvh_emit writes for r
+template <class K>
+int lbvh_count(const lbvh_tree<K>& tree, const lbvh_range& r, int depth)
+{
+    if (r.hi - r.lo + 1 <= bvh_max_prims_in_node) return 1;
+    lbvh_range c[2];
+    lbvh_children(tree, r, depth, c);
+    return 1 + lbvh_count(tree, c[0], depth+1) + lbvh_count(tree, c[1], depth+1);
+}
+
+// node of the top levels lbvh_flatten walks itself, second is -1 for the subtrees below
+struct lbvh_top_node
+{
+    lbvh_range range;
+    int depth, axis;
+    int second; // index in the top list of the second child
+    int offset, count;
+};
+
+template <class K>
+int lbvh_collect_top(const lbvh_tree<K>& tree, const lbvh_range& r, int depth, int split_depth, std::vector<lbvh_top_node>& top)
+{
+    int index = int(top.size());
+    lbvh_top_node t = {r, depth, 0, -1, 0, 1};
+    top.push_back(t);
+    if (depth == split_depth || r.hi - r.lo + 1 <= bvh_max_prims_in_node)
+    {
+        return index;
+    }
+    lbvh_range c[2];
+    top[index].axis = lbvh_children(tree, r, depth, c);
+    lbvh_collect_top(tree, c[0], depth+1, split_depth, top);
+    int second = lbvh_collect_top(tree, c[1], depth+1, split_depth, top);
+    top[index].second = second;
+    return index;
+}
+
+// LBVH straight into the flat layout without a build tree. the subtrees below
+// split_depth are counted on their own threads, then written at their offsets.
+template <class K>
+linear_bvh_node *lbvh_flatten(bvh_primitive *prims, int n, int nt, int& node_count)
+{
+    lbvh_tree<K> tree;
+    lbvh_build_tree(prims, n, nt, tree);
+
+    int split_depth = 0;
+    while ((1 << split_depth) < 4*nt) split_depth++;
+    std::vector<lbvh_top_node> top;
+    lbvh_collect_top(tree, lbvh_root(tree), 0, split_depth, top);
+    std::vector<int> sub;
+    for (int t = 0; t < int(top.size()); t++)
+    {
+        if (top[t].second < 0) sub.push_back(t);
+    }
+    parallel_for(int(sub.size()), nt, [&](int begin, int end, int thread) {
+        for (int s = begin; s < end; s++)
+        {
+            lbvh_top_node& t = top[sub[s]];
+            t.count = lbvh_count(tree, t.range, t.depth);
+        }
+    });
+    node_count = 0;
+    for (int t = 0; t < int(top.size()); t++)
+    {
+        top[t].offset = node_count;
+        node_count += top[t].count;
+    }
+
+    linear_bvh_node *nodes = new linear_bvh_node[node_count];
+    parallel_for(int(sub.size()), nt, [&](int begin, int end, int thread) {
+        for (int s = begin; s < end; s++)
+        {
+            const lbvh_top_node& t = top[sub[s]];
+            lbvh_emit(tree, t.range, t.depth, nodes, t.offset);
+        }
+    });
+    // children come after their parent, so back to front has them done first
+    for (int t = int(top.size())-1; t >= 0; t--)
+    {
+        if (top[t].second < 0) continue;
+        linear_bvh_node& node = nodes[top[t].offset];
+        node.pad = 0;
+        node.axis = top[t].axis;
+        node.n_primitives = 0;
+        node.second_child_offset = top[top[t].second].offset;
+        merge_node_bounds(node, nodes[top[t].offset+1], nodes[node.second_child_offset]);
+    }
+    free_lbvh_tree(tree);
+    return nodes;
+}
+
+// flattened nodes over prims with the chosen builder, prims is reordered to match the leaves
+linear_bvh_node *build_linear_bvh_nodes(bvh_primitive *prims, int n, bvh_builder builder, int nt, int& node_count)
+{
+    if (builder == BVH_LBVH)
+    {
+        if (lbvh_narrow_keys(n))
+        {
+            return lbvh_flatten<unsigned int>(prims, n, nt, node_count);
+        }
+        return lbvh_flatten<unsigned long long>(prims, n, nt, node_count);
+    }
+    bvh_build_node *root = build_bvh_tree(prims, n, builder, nt);
+    node_count = count_nodes(root);
+    linear_bvh_node *nodes = new linear_bvh_node[node_count];
+    int offset = 0;
+    flatten_bvh(root, nodes, offset);
+    free_build_tree(root);
+    return nodes;
+}
+
+// slab test against a flattened node with the precomputed inverse direction
+inline bool hit_node(const linear_bvh_node& node, const vec3& org, const vec3& inv_dir,
+                     const int dir_is_neg[3], float t_min, float t_max)
+{
+    float tx0 = (node.bounds[dir_is_neg[0]][0] - org.x()) * inv_dir.x();
+    float tx1 = (node.bounds[1-dir_is_neg[0]][0] - org.x()) * inv_dir.x();
+    float ty0 = (node.bounds[dir_is_neg[1]][1] - org.y()) * inv_dir.y();
+    float ty1 = (node.bounds[1-dir_is_neg[1]][1] - org.y()) * inv_dir.y();
+    float tz0 = (node.bounds[dir_is_neg[2]][2] - org.z()) * inv_dir.z();
+    float tz1 = (node.bounds[1-dir_is_neg[2]][2] - org.z()) * inv_dir.z();
+    t_min = ffmax(t_min, ffmax(tx0, ffmax(ty0, tz0)));
+    t_max = ffmin(t_max, ffmin(tx1, ffmin(ty1, tz1)));
+    return t_min <= t_max;
+}
+
+// single ray traversal of a flattened BVH, shared by the closest hit and any hit
+// queries. leaf(node, t_max) tests the node's primitives, it can shrink t_max to cull
+// farther nodes or return true to end the traversal, which then returns true too.
+// near_first visits the near child of every node first (closest hit wants that).
+template <class Leaf>
+bool traverse_ray(const linear_bvh_node *nodes, const ray& r, float t_min, float t_max, bool near_first, const Leaf& leaf)
+{
+    vec3 org = r.origin();
+    vec3 inv_dir(1.0f/r.direction().x(), 1.0f/r.direction().y(), 1.0f/r.direction().z());
+    int dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+
+    int to_visit[bvh_stack_size];
+    int to_visit_offset = 0;
+    int current = 0;
+    while (true)
+    {
+        const linear_bvh_node& node = nodes[current];
+        if (hit_node(node, org, inv_dir, dir_is_neg, t_min, t_max))
+        {
+            if (node.n_primitives > 0)
+            {
+                if (leaf(node, t_max))
+                {
+                    return true;
+                }
+            }
+            else
+            {
+                // push the far child
+                if (near_first && dir_is_neg[node.axis])
+                {
+                    to_visit[to_visit_offset++] = current + 1;
+                    current = node.second_child_offset;
+                }
+                else
+                {
+                    to_visit[to_visit_offset++] = node.second_child_offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (to_visit_offset == 0) break;
+        current = to_visit[--to_visit_offset];
+    }
+    return false;
+}
+
+// closest hit traversal of a flattened BVH with a coherent
+// packet. every node is tested for the rays that reached its parent, children are
+// visited near first along the packet's shared direction signs. leaf(node, mask)
+// intersects the node's primitives with the rays in mask and returns the rays it hit.
+template <class Leaf>
+int traverse_packet(const linear_bvh_node *nodes, ray_packet& p, int mask, float t_min, const Leaf& leaf)
+{
+    int hits = 0;
+    int to_visit[bvh_stack_size];
+    int to_visit_mask[bvh_stack_size];
+    int to_visit_offset = 0;
+    int current = 0;
+    int current_mask = mask;
+    while (true)
+    {
+        const linear_bvh_node& node = nodes[current];
+        int active = packet_hits_box(node.bounds, p, current_mask, t_min);
+        if (active)
+        {
+            if (node.n_primitives > 0)
+            {
+                hits |= leaf(node, active);
+            }
+            else
+            {
+                int near = p.dir_is_neg[node.axis] ? node.second_child_offset : current + 1;
+                int far = p.dir_is_neg[node.axis] ? current + 1 : node.second_child_offset;
+                to_visit[to_visit_offset] = far;
+                to_visit_mask[to_visit_offset++] = active;
+                current = near;
+                current_mask = active;
+                continue;
+            }
+        }
+        if (to_visit_offset == 0) break;
+        current = to_visit[--to_visit_offset];
+        current_mask = to_visit_mask[to_visit_offset];
+    }
+    return hits;
+}
+
+// flattened BVH over contiguous sphere storage, traversed with a fixed size stack
+class linear_bvh : public hitable
+{
+    public:
+        linear_bvh() {}
+        linear_bvh(sphere **l, int n, bvh_builder b = BVH_BINNED_SAH, int threads = 1);
+        virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual int hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const;
+        void build(sphere **l, int n);
+        void order_spheres(const bvh_primitive *prims, sphere **l, int n);
+        bool update(sphere **l, int n);
+        void refit_node(int i);
+        void refit_top(int node, int end, int depth, int split_depth, int *top, int& top_count, int *sub, int& sub_count);
+        float sah_cost() const;
+
+        linear_bvh_node *nodes;
+        int node_count;
+        // leaves are ranges of this
+        sphere_soa *spheres;
+        // input index of every sphere in leaf order, so update() can find its new data
+        int *sphere_index;
+        bvh_builder builder;
+        int nt;
+        float built_cost;
+};
+
+linear_bvh::linear_bvh(sphere **l, int n, bvh_builder b, int threads)
+{
+    builder = b;
+    nt = threads;
+    build(l, n);
+}
+
+void linear_bvh::build(sphere **l, int n)
+{
+    bvh_primitive *prims = make_bvh_primitives(l, n, nt);
+    nodes = build_linear_bvh_nodes(prims, n, builder, nt, node_count);
+    order_spheres(prims, l, n);
+    delete [] prims;
+    built_cost = sah_cost();
+}
+
+// copies the spheres into leaf order
+void linear_bvh::order_spheres(const bvh_primitive *prims, sphere **l, int n)
+{
+    sphere **ordered = new sphere*[n];
+    sphere_index = new int[n];
+    parallel_for(n, nt, [&](int begin, int end, int thread) {
+        for (int i = begin; i < end; i++)
+        {
+            ordered[i] = l[prims[i].index];
+            sphere_index[i] = prims[i].index;
+        }
+    });
+    spheres = new sphere_soa(ordered, n);
+    delete [] ordered;
+}
+
+// takes new centers and radii for the same spheres the tree was built with (same l and n)
+// and refits the node bounds bottom up. returns true if it had to rebuild instead because
+// the refitted tree got too slow, i.e. its SAH cost grew past bvh_refit_max_cost_growth.
+bool linear_bvh::update(sphere **l, int n)
+{
+    parallel_for(n, nt, [&](int begin, int end, int thread) {
+        for (int i = begin; i < end; i++)
+        {
+            const sphere *s = l[sphere_index[i]];
+            spheres->center_x[i] = s->center.x();
+            spheres->center_y[i] = s->center.y();
+            spheres->center_z[i] = s->center.z();
+            spheres->radius[i] = s->radius;
+        }
+    });
+
+    // subtrees are contiguous in the depth first array and children come after their
+    // parent, so each subtree below split_depth refits back to front on its own thread,
+    // then the few nodes above them are done in reverse depth first order here
+    int split_depth = 0;
+    while ((1 << split_depth) < 4*nt) split_depth++;
+    int *top = new int[1 << split_depth];
+    int *sub = new int[2 << split_depth];
+    int top_count = 0;
+    int sub_count = 0;
+    refit_top(0, node_count, 0, split_depth, top, top_count, sub, sub_count);
+    parallel_for(sub_count/2, nt, [&](int begin, int end, int thread) {
+        for (int s = begin; s < end; s++)
+        {
+            for (int i = sub[2*s+1]-1; i >= sub[2*s]; i--)
+            {
+                refit_node(i);
+            }
+        }
+    });
+    for (int t = top_count-1; t >= 0; t--)
+    {
+        refit_node(top[t]);
+    }
+    delete [] sub;
+    delete [] top;
+
+    if (sah_cost() > bvh_refit_max_cost_growth * built_cost)
+    {
+        delete [] nodes;
+        delete [] sphere_index;
+        delete spheres;
+        build(l, n);
+        return true;
+    }
+    return false;
+}
+
+// collects the nodes above split_depth (top) and the [begin, end) ranges of the subtrees below it (sub)
+void linear_bvh::refit_top(int node, int end, int depth, int split_depth, int *top, int& top_count, int *sub, int& sub_count)
+{
+    if (depth == split_depth || nodes[node].n_primitives > 0)
+    {
+        sub[sub_count++] = node;
+        sub[sub_count++] = end;
+        return;
+    }
+    top[top_count++] = node;
+    int second = nodes[node].second_child_offset;
+    refit_top(node+1, second, depth+1, split_depth, top, top_count, sub, sub_count);
+    refit_top(second, end, depth+1, split_depth, top, top_count, sub, sub_count);
+}
+
+void linear_bvh::refit_node(int i)
+{
+    linear_bvh_node& node = nodes[i];
+    if (node.n_primitives > 0)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            node.bounds[0][a] = MAXFLOAT;
+            node.bounds[1][a] = -MAXFLOAT;
+        }
+        for (int p = node.primitives_offset; p < node.primitives_offset + node.n_primitives; p++)
+        {
+            float r = fabs(spheres->radius[p]);
+            float c[3] = {spheres->center_x[p], spheres->center_y[p], spheres->center_z[p]};
+            for (int a = 0; a < 3; a++)
+            {
+                node.bounds[0][a] = ffmin(node.bounds[0][a], c[a] - r);
+                node.bounds[1][a] = ffmax(node.bounds[1][a], c[a] + r);
+            }
+        }
+        return;
+    }
+    merge_node_bounds(node, nodes[i+1], nodes[node.second_child_offset]);
+}
+
+inline float node_area(const linear_bvh_node& node)
+{
+    float dx = node.bounds[1][0] - node.bounds[0][0];
+    float dy = node.bounds[1][1] - node.bounds[0][1];
+    float dz = node.bounds[1][2] - node.bounds[0][2];
+    return 2.0f*(dx*dy + dy*dz + dz*dx);
+}
+
+// expected cost of a random ray through the tree relative to the root box
+float linear_bvh::sah_cost() const
+{
+    double *thread_cost = new double[nt];
+    for (int t = 0; t < nt; t++)
+    {
+        thread_cost[t] = 0;
+    }
+    parallel_for(node_count, nt, [&](int begin, int end, int thread) {
+        double cost = 0;
+        for (int i = begin; i < end; i++)
+        {
+            cost += node_area(nodes[i]) * (nodes[i].n_primitives > 0 ? nodes[i].n_primitives : bvh_traversal_cost);
+        }
+        thread_cost[thread] = cost;
+    });
+    double cost = 0;
+    for (int t = 0; t < nt; t++)
+    {
+        cost += thread_cost[t];
+    }
+    delete [] thread_cost;
+    return float(cost / node_area(nodes[0]));
+}
+
+bool linear_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    bool hit_anything = false;
+    traverse_ray(nodes, r, t_min, t_max, true, [&](const linear_bvh_node& node, float& t_max) {
+        int first = node.primitives_offset;
+        if (spheres->hit_range(r, t_min, t_max, first, first + node.n_primitives, rec))
+        {
+            hit_anything = true;
+            t_max = rec.t;
+        }
+        return false;
+    });
+    return hit_anything;
+}
+
+// closest hits of a packet, the whole packet walks the tree at once and leaves test
+// their spheres a vector of rays at a time. packets that are not coherent go ray by ray
+int linear_bvh::hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const
+{
+    p.prepare();
+    if (!p.coherent)
+    {
+        return hitable::hit_packet(p, mask, t_min, recs);
+    }
+    return traverse_packet(nodes, p, mask, t_min, [&](const linear_bvh_node& node, int active) {
+        int hits = 0;
+        for (int i = node.primitives_offset; i < node.primitives_offset + node.n_primitives; i++)
+        {
+            vec3 center(spheres->center_x[i], spheres->center_y[i], spheres->center_z[i]);
+            int found = hit_sphere_packet(p, active, t_min, center, spheres->radius[i]);
+            for (int k = 0; k < packet_size; k++)
+            {
+                if ((found >> k) & 1)
+                {
+                    recs[k].t = p.t_max[k];
+                    recs[k].obj = spheres;
+                    recs[k].prim_id = i;
+                    recs[k].inst = NULL;
+                }
+            }
+            hits |= found;
+        }
+        return hits;
+    });
+}
+
+// any hit traversal, returns at the first leaf that blocks the ray
+bool linear_bvh::occluded(const ray& r, float t_min, float t_max) const
+{
+    return traverse_ray(nodes, r, t_min, t_max, false, [&](const linear_bvh_node& node, float& t_max) {
+        int first = node.primitives_offset;
+        return spheres->occluded_range(r, t_min, t_max, first, first + node.n_primitives);
+    });
+}
+
+bool linear_bvh::bounding_box(aabb& box) const
+{
+    box = aabb(vec3(nodes[0].bounds[0][0], nodes[0].bounds[0][1], nodes[0].bounds[0][2]),
+               vec3(nodes[0].bounds[1][0], nodes[0].bounds[1][1], nodes[0].bounds[1][2]));
+    return true;
+}
+
+#endif //LINEARBVHH
@@ -1,5 +1,8 @@
 #include <iostream>
+#include <chrono>
+#include <algorithm>
 // compile with g++ main.cc -pthread
+// add -O2 -mavx2 (or -march=native) to get the 8 wide BVH, SSE builds use the 4 wide one
 
 // include and implement stb_image stuff
 #define STB_IMAGE_IMPLEMENTATION
@@ -10,47 +13,113 @@
 // include my classes
 #include "sphere.h"
 #include "hitable_list.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+#include "instance.h"
 #include "camera.h"
 #include "material.h"
 #include "texture.h"
 #include "kensler_noise.h"
-
-// color and fallback to background color
-vec3 color(const ray& r, hitable *world, int depth) 
+#include "lights.h"
+#include "light_bvh.h"
+#include "render_settings.h"
+
+// iterative path tracer, throughput is the product of the attenuations so far.
+// after rr_depth bounces a path only continues with probability p (its brightest
+// throughput channel, at most 0.95) and is divided by p, so dim paths end early
+// without biasing the image. with light sampling on, every diffuse hit also samples
+// a light directly and emitters found by scattering are weighted against that.
+// if primary is set r_in was already traced (in a packet), primary->obj is NULL for a miss
+vec3 color(const ray& r_in, hitable *world, const light_sampler& lights, const render_settings& settings, sampler& rnd,
+           const hit_record *primary = NULL)
 {
-    hit_record rec;
-    // ignore small t values
-    if (world->hit(r, 0.001, MAXFLOAT, rec))
+    vec3 col(0,0,0);
+    vec3 throughput(1,1,1);
+    ray r = r_in;
+    // density the last diffuse bounce picked r with, 0 after mirrors and glass,
+    // and its normal, the light sampler's choice depends on it
+    float scattering_pdf = 0;
+    vec3 scattering_normal;
+    for (int depth = 0; ; depth++)
     {
-        // material shading
-        ray scattered;
-        vec3 attenuation;
-        vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-        if (depth < 50 && rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+        hit_record rec;
+        bool found;
+        if (depth == 0 && primary)
         {
-            return emitted + attenuation*color(scattered, world, depth+1);
+            rec = *primary;
+            found = rec.obj != NULL;
         }
         else
         {
-            return emitted;
+            // ignore small t values
+            found = world->hit(r, 0.001, MAXFLOAT, rec);
+        }
+        if (!found)
+        {
+            // black if nothing else
+            break;
+
+            // fallback to the blue/white gradient (sky)
+            // vec3 unit_direction = unit_vector(r.direction());
+            // float t = 0.5*(unit_direction.y() + 1.0);
+            // col += throughput*((1.0-t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0));
+            // break;
         }
+        finalize_hit(r, rec);
 
         // normal shading
         // return 0.5*vec3(rec.normal.x()+1, rec.normal.y()+1, rec.normal.z()+1);
-    }
-    else
-    {
-        // black if nothing else
-        return vec3(0,0,0);
 
-        // fallback to the blue/white gradient (sky)
-        // vec3 unit_direction = unit_vector(r.direction());
-        // float t = 0.5*(unit_direction.y() + 1.0);
-        // return (1.0-t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0);
+        // material shading
+        vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        float weight = 1;
+        int light = settings.light_sampling && scattering_pdf > 0 && rec.mat_ptr->is_emissive() ? lights.find(rec) : -1;
+        if (light >= 0)
+        {
+            float light_pdf = lights.probability(r.origin(), scattering_normal, light) * sphere_light_pdf(lights.light(light), r.origin());
+            weight = mis_weight(scattering_pdf, light_pdf);
+        }
+        col += throughput*emitted*weight;
+
+        ray scattered;
+        vec3 attenuation;
+        rnd.start_dimensions(bounce_dimension(depth, bsdf_dimension), 4);
+        if (depth >= settings.max_depth || !rec.mat_ptr->scatter(r, rec, attenuation, scattered, rnd))
+        {
+            break;
+        }
+        scattering_pdf = rec.mat_ptr->scattering_pdf(r, rec, scattered);
+        scattering_normal = rec.normal;
+        ray shadow;
+        float dist;
+        vec3 contribution;
+        if (settings.light_sampling && scattering_pdf > 0 &&
+            sample_light(r, rec, attenuation, lights, depth, rnd, shadow, dist, contribution) &&
+            !world->occluded(shadow, 0.001, dist*0.999f))
+        {
+            col += throughput*contribution;
+        }
+        throughput *= attenuation;
+
+        if (depth >= settings.rr_depth)
+        {
+            float p = ffmin(0.95f, ffmax(throughput[0], ffmax(throughput[1], throughput[2])));
+            rnd.start_dimensions(bounce_dimension(depth, roulette_dimension), 1);
+            if (rnd.next_float() >= p)
+            {
+                break;
+            }
+            throughput /= p;
+        }
+        r = scattered;
     }
+    return col;
 }
 
-hitable* setup_world()
+// nt is the number of threads used to build the acceleration structure,
+// every emissive sphere of the scene is added to lights. instanced builds the
+// same scene as instances under an instance_bvh
+hitable* setup_world(int nt, light_list& lights, bool instanced)
 {
     // initialize kensler noise
     kensler::init();
@@ -81,7 +150,7 @@ hitable* setup_world()
     // hitable *world = new hitable_list(list, 4);
 
     // Objects made with Audrey!
-    hitable **list = new hitable*[12];
+    sphere **list = new sphere*[12];
     texture *noise = new marble_texture(new constant_texture(vec3(0.2,0.3,0.5)), new constant_texture(vec3(0.6,1.0,0.8)));
     // list[0] = new sphere(vec3(0,-100.5, -1), 100, new lambertian(noise));//139, 69, 19
     // texture *checker = new checker_texture(new constant_texture(vec3(0.6,0.6,0.6)), new constant_texture(vec3(0.1,0.1,0.1)));
@@ -116,81 +185,221 @@ hitable* setup_world()
     // texture *checker = new checker_texture(new constant_texture(vec3(0.6,0.6,0.7)), new constant_texture(vec3(0.0,0.0,0.2)));
     // list[6] = new sphere(vec3(0,-100.5, -1), 1000, new diffuse_light(checker));//139, 69, 19
     list[6] = new sphere(vec3(0,-100.5, -1), 1000, new diffuse_light(new constant_texture(vec3(0.7,0.7,0.9))));//139, 69, 19
-    hitable *world = new hitable_list(list, 12);
+    if (instanced)
+    {
+        // the same spheres as instances of one shared unit sphere, each moved and scaled
+        // into place with its own material. a bigger shared object would be a bottom level
+        // linear_bvh or wide_bvh, built once and placed by as many instances as needed
+        sphere *unit = new sphere(vec3(0,0,0), 1, NULL);
+        instance **instances = new instance*[12];
+        for (int i = 0; i < 12; i++)
+        {
+            float r = list[i]->radius;
+            instances[i] = new instance(unit, translation(list[i]->center) * scaling(vec3(r,r,r)), list[i]->mat_ptr);
+        }
+        hitable *world = new instance_bvh(instances, 12, BVH_BINNED_SAH, nt);
+        lights.add(world);
+        return world;
+    }
+    // hitable *world = new hitable_list((hitable **)list, 12);
+    // hitable *world = new bvh_node((hitable **)list, 12);
+    // hitable *world = new sphere_soa(list, 12);
+    // hitable *world = new linear_bvh(list, 12, BVH_BINNED_SAH, nt);
+    // BVH_LBVH rebuilds much faster (animated scenes), BVH_SWEEP_SAH gives the best tree
+    hitable *world = new wide_bvh<simd_width>(list, 12, BVH_BINNED_SAH, nt);
+    // lights are looked up by what a ray hits, so they come from the world itself
+    lights.add(world);
 
     return world;
 }
 
-#include <pthread.h>
+#include <unistd.h>
+#include "scheduler.h"
+#include "film.h"
+#include "wavefront.h"
 
-struct prog_state
-{
-    hitable* world;
-    unsigned char *data;
-    camera *cam;
-    int tid;
-    int nx, ny, ns, nt;
-};
-
-void *thread_main(void *global_state)
+// renders every pixel of tile t into the film. every sample gets its random numbers
+// from its pixel, index and frame, so the image does not depend on the thread count,
+// tile size or the order tiles are rendered in. pixels get ns samples, or the counts
+// in settings.pixel_samples
+void render_tile(const tile& t, hitable *world, const light_sampler& lights, const camera& cam, film& image, const render_settings& settings)
 {
-    // get state passed in
-    prog_state gs = *(prog_state *)global_state;
-    int ns = gs.ns;
-    int nx = gs.nx;
-    int ny = gs.ny;
-    int nt = gs.nt;
-    hitable* world = gs.world;
-    unsigned char* data = gs.data;
-    camera cam = *gs.cam;
-
-    srand48(gs.tid);
-
-    // loop over pixels
-    for (int j = ny-1; j >= 0; j--)
+    int nx = image.nx;
+    int ny = image.ny;
+    sampler *rnd = new_sampler(settings.sampling, settings.frame, settings.seed);
+    for (int j = t.y0; j < t.y1; j++)
     {
-        for (int i = 0; i < nx; i++)
+        for (int i = t.x0; i < t.x1; i++)
         {
+            int first = settings.first_sample;
+            int samples = settings.ns;
+            if (settings.pixel_samples)
+            {
+                first = image.count[i + j*nx];
+                samples = settings.pixel_samples[i + j*nx];
+                if (samples == 0) continue;
+            }
             vec3 col(0,0,0);
+            double luminance_sq = 0;
 
-            for (int s=0; s < ns; s++)
+            for (int s = 0; s < samples; s++)
             {
-                float u = float(i + drand48()) / float(nx);
-                float v = float(j + drand48()) / float(ny);
+                rnd->start_sample(i, j, first + s);
+                float u = float(i + rnd->next_float()) / float(nx);
+                float v = float(j + rnd->next_float()) / float(ny);
 
-                ray r = cam.get_ray(u, v);
+                ray r = cam.get_ray(u, v, *rnd);
                 
-                col += color(r, world, 0);
+                vec3 sample = color(r, world, lights, settings, *rnd);
+                col += sample;
+                float l = luminance(sample);
+                luminance_sq += l*l;
             }
 
-            // normalize color
-            col /= float(ns);
-            // normalize with number of threads
-            col /= float(nt);
-            // gamma correct
-            // TODO: this needs to happen outside of the thread, 
-            //       everything below will need to move
-            col = vec3( sqrt(col[0]), sqrt(col[1]), sqrt(col[2]) );
-
-            // store color in image buffer
-            int ir = int(255.99*col[0]);
-            int ig = int(255.99*col[1]);
-            int ib = int(255.99*col[2]);
-
-            // this fixed a bug in the chapter2 y mapping for the image
-            int pix_id = (i+nx*(ny-1)-j*nx)*3;
-
-            data[pix_id+0] = ir;
-            data[pix_id+1] = ig;
-            data[pix_id+2] = ib;
+            // linear sum, gamma and quantization happen once for the whole image
+            image.add(i, j, col, luminance_sq, samples);
+        }
+    }
+    delete rnd;
+}
+
+// adaptive sampling with a budget of ns samples per pixel for the whole frame. every
+// pixel gets min_samples, then each round gives batch_samples more to the noisiest
+// half of the pixels that are above max_error and below max_samples, until the budget
+// is spent or no pixel needs more. what converged pixels leave goes to the noisy ones
+void render_adaptive(hitable *world, const light_sampler& lights, const camera& cam, film& image, const render_settings& settings, int tile_size, int nt)
+{
+    int pixels = image.nx * image.ny;
+    long long budget = (long long)settings.ns * pixels;
+    int *samples = new int[pixels];
+    float *error = new float[pixels];
+    int *order = new int[pixels];
+    for (int p = 0; p < pixels; p++)
+    {
+        samples[p] = settings.min_samples < settings.max_samples ? settings.min_samples : settings.max_samples;
+    }
+    render_settings round = settings;
+    round.pixel_samples = samples;
+    long long spent = 0;
+    while (true)
+    {
+        tile_scheduler scheduler(image.nx, image.ny, tile_size, nt);
+        scheduler.run([&](const tile& t, int thread) {
+            render_tile(t, world, lights, cam, image, round);
+        });
+
+        int candidates = 0;
+        for (int p = 0; p < pixels; p++)
+        {
+            spent += samples[p];
+            samples[p] = 0;
+            error[p] = image.error(p % image.nx, p / image.nx);
+            if (image.count[p] < settings.max_samples && error[p] > settings.max_error)
+            {
+                order[candidates++] = p;
+            }
+        }
+        std::sort(order, order + candidates, [&](int a, int b) { return error[a] > error[b]; });
+        long long take = (candidates + 1) / 2;
+        if (take > (budget - spent) / settings.batch_samples)
+        {
+            take = (budget - spent) / settings.batch_samples;
+        }
+        if (take <= 0) break;
+        for (int k = 0; k < take; k++)
+        {
+            int p = order[k];
+            int left = settings.max_samples - image.count[p];
+            samples[p] = settings.batch_samples < left ? settings.batch_samples : left;
         }
     }
+    delete [] samples;
+    delete [] error;
+    delete [] order;
+}
 
-    pthread_exit(NULL);
+// render_tile with the camera rays of 4x2 pixel blocks traced as packets, one packet
+// per sample index. the rest of every path is traced ray by ray as before, and the
+// image is the same. fixed sample counts only
+void render_tile_packets(const tile& t, hitable *world, const light_sampler& lights, const camera& cam, film& image, const render_settings& settings)
+{
+    const int block_x = 4;
+    const int block_y = packet_size / block_x;
+    int nx = image.nx;
+    int ny = image.ny;
+    sampler *rnd[packet_size];
+    for (int k = 0; k < packet_size; k++)
+    {
+        rnd[k] = new_sampler(settings.sampling, settings.frame, settings.seed);
+    }
+    for (int by = t.y0; by < t.y1; by += block_y)
+    {
+        for (int bx = t.x0; bx < t.x1; bx += block_x)
+        {
+            int mask = 0;
+            for (int k = 0; k < packet_size; k++)
+            {
+                if (bx + k % block_x < t.x1 && by + k / block_x < t.y1)
+                {
+                    mask |= 1 << k;
+                }
+            }
+            vec3 col[packet_size];
+            double luminance_sq[packet_size];
+            for (int k = 0; k < packet_size; k++)
+            {
+                col[k] = vec3(0,0,0);
+                luminance_sq[k] = 0;
+            }
+
+            for (int s = 0; s < settings.ns; s++)
+            {
+                ray_packet p;
+                hit_record recs[packet_size];
+                for (int k = 0; k < packet_size; k++)
+                {
+                    // lanes outside the tile trace a copy of the first ray, masked out
+                    int lane = (mask >> k) & 1 ? k : 0;
+                    int i = bx + lane % block_x;
+                    int j = by + lane / block_x;
+                    rnd[k]->start_sample(i, j, settings.first_sample + s);
+                    float u = float(i + rnd[k]->next_float()) / float(nx);
+                    float v = float(j + rnd[k]->next_float()) / float(ny);
+                    p.set(k, cam.get_ray(u, v, *rnd[k]));
+                    p.t_max[k] = MAXFLOAT;
+                    recs[k].obj = NULL;
+                }
+                world->hit_packet(p, mask, 0.001, recs);
+
+                for (int k = 0; k < packet_size; k++)
+                {
+                    if (!((mask >> k) & 1)) continue;
+                    vec3 sample = color(p.get(k), world, lights, settings, *rnd[k], &recs[k]);
+                    col[k] += sample;
+                    float l = luminance(sample);
+                    luminance_sq[k] += l*l;
+                }
+            }
+
+            for (int k = 0; k < packet_size; k++)
+            {
+                if ((mask >> k) & 1)
+                {
+                    image.add(bx + k % block_x, by + k / block_x, col[k], luminance_sq[k], settings.ns);
+                }
+            }
+        }
+    }
+    for (int k = 0; k < packet_size; k++)
+    {
+        delete rnd[k];
+    }
 }
 
 int main()
 {
+    // the time budget covers the whole frame, scene and BVH builds included
+    auto frame_start = std::chrono::steady_clock::now();
     int nx = 200;
     int ny = 100;
     // int nx = 607;
@@ -202,15 +411,74 @@ int main()
     // sample count: 10 is very fast and noisy, 100 is reasonable (used in book)
     // 1000 is kinda slow but looks pretty good, more is probably needed for quality
     int ns = 100;
-    // number of software threads (ns happens per thread)
-    // TODO: need to average threads in linear space, until fixed, keep this at 1.
-    int nt = 1;
-
-    // output buffer
-    unsigned char *data = new unsigned char[nx*ny*3*nt];
-
-    // get top level hitable from world setup
-    hitable *world = setup_world();
+    // adaptive sampling instead: the frame spends ns samples per pixel on average. every
+    // pixel gets at least min_samples, the rest goes to the noisiest pixels until their
+    // relative error drops below max_error or they reach max_samples. too few
+    // min_samples can stop on pixels that only rarely see a bright path
+    bool adaptive = false;
+    int min_samples = 32;
+    int max_samples = 1024;
+    float max_error = 0.02;
+    // also write the samples each pixel took to samples.png
+    bool write_sample_map = true;
+    // progressive mode renders passes of pass_samples over the whole image until the time
+    // budget (seconds, counted from the start of the frame so builds are included) would
+    // be exceeded by the next pass, the average relative error of the pixels drops below
+    // target_error or max_samples is reached. 0 turns a limit off. there is always at
+    // least one pass, so the image is complete even on a tiny budget
+    bool progressive = false;
+    int pass_samples = 4;
+    double time_budget = 10;
+    float target_error = 0;
+    // longest path, and the bounce after which russian roulette may end paths early
+    int max_depth = 50;
+    int rr_depth = 3;
+    // next event estimation, much less noise from small lights
+    bool light_sampling = true;
+    // from this many lights on they are picked with the light BVH instead of uniformly
+    int light_tree_min = 16;
+    // owen scrambled sobol points stratify pixel, lens and bounce samples and converge
+    // faster than independent random numbers, best with power of two sample counts
+    sampler_type sampling = SAMPLER_SOBOL;
+    // wavefront mode advances a batch of wave_size paths one bounce at a time in stages
+    // instead of rendering tiles path by path. same image, no adaptive sampling. waves
+    // that fit the path state in cache are the fastest
+    bool wavefront = false;
+    int wave_size = 1 << 12;
+    // sort the bounced rays of a wave by direction octant and origin before tracing
+    // them, same image. meant for scenes far bigger than the cache, costs a little here
+    bool reorder_rays = false;
+    // trace the camera rays of neighbouring pixels as packets, same image. wide_bvh,
+    // linear_bvh and instance_bvh have packet traversals, other worlds trace the packet's
+    // rays one by one. wavefront and adaptive sampling trace single rays
+    bool packets = true;
+    // build the scene from instances of one shared sphere under an instance_bvh, same image
+    bool instanced = false;
+    // number of software threads, one per core. threads take tiles from their own
+    // queue and steal from the others when it runs dry, every pixel is rendered once
+    int nt = sysconf(_SC_NPROCESSORS_ONLN);
+    // tile edge in pixels, small enough to balance well, big enough to keep rays coherent
+    int tile_size = 16;
+    // global seed and frame number, every sample's random numbers derive from them
+    uint64_t seed = 0;
+    int frame = 0;
+
+    // linear accumulation buffer, shared by all threads
+    film image(nx, ny);
+
+    // get top level hitable from world setup, timed separately from rendering
+    auto build_start = std::chrono::steady_clock::now();
+    light_list lights;
+    hitable *world = setup_world(nt, lights, instanced);
+    // with many lights the hierarchy picks the ones that matter at each point,
+    // for a handful uniform picking is about as good and cheaper
+    light_sampler *light_picker = &lights;
+    if (int(lights.lights.size()) >= light_tree_min)
+    {
+        light_picker = new light_bvh(&lights, nt);
+    }
+    auto build_end = std::chrono::steady_clock::now();
+    std::cerr << "build time: " << std::chrono::duration<double>(build_end - build_start).count() << " s" << std::endl;
 
     // camera
     vec3 lookfrom(1,0.75,2); //3,3,2 value from book
@@ -219,71 +487,90 @@ int main()
     float aperture = 0.25; // 2.0 value from book
     camera cam(lookfrom, lookat, vec3(0,1,0), 20, float(nx)/float(ny), aperture, dist_to_focus);
 
-    // parallel threads
-    pthread_t *threads = new pthread_t[nt];
-    prog_state *pstate = new prog_state[nt];
-
-    // loop over threads
-    for (int t = 0; t < nt; t++)
-    {
-        // set up state
-        pstate[t].tid = t;
-        pstate[t].world = world;
-        pstate[t].data = data + t*nx*ny*3;
-        pstate[t].cam = &cam;
-        pstate[t].ns = ns;
-        pstate[t].nx = nx;
-        pstate[t].ny = ny;
-        pstate[t].nt = nt;
-
-        // try creating thread
-        int rc = pthread_create(&threads[t], NULL, thread_main, (void *)&pstate[t]);
-        if (rc)
+    render_settings settings;
+    settings.ns = ns;
+    settings.max_depth = max_depth;
+    settings.rr_depth = rr_depth;
+    settings.light_sampling = light_sampling;
+    settings.adaptive = adaptive && !wavefront;
+    settings.min_samples = min_samples;
+    settings.max_samples = max_samples;
+    settings.batch_samples = 8;
+    settings.max_error = max_error;
+    settings.sampling = sampling;
+    settings.frame = frame;
+    settings.seed = seed;
+    settings.first_sample = 0;
+    settings.reorder_rays = reorder_rays;
+    settings.pixel_samples = NULL;
+
+    // one pass of settings.ns samples per pixel, or of adaptive sampling
+    auto render_pass = [&]() {
+        if (wavefront)
         {
-            std::cerr << "ERROR; return code from pthread_create: " << rc << std::endl;
-            exit(-1);
+            wavefront_renderer renderer(world, light_picker, &cam, settings, nt, wave_size);
+            renderer.render(image);
+            return;
         }
-    }
-
-    // wait for threads to finish
-    for (int t = 0; t < nt; t++)
-    {
-        pthread_join(threads[t], NULL);
-    }
+        if (settings.adaptive)
+        {
+            render_adaptive(world, *light_picker, cam, image, settings, tile_size, nt);
+            return;
+        }
+        tile_scheduler scheduler(nx, ny, tile_size, nt);
+        scheduler.run([&](const tile& t, int thread) {
+            if (packets)
+            {
+                render_tile_packets(t, world, *light_picker, cam, image, settings);
+            }
+            else
+            {
+                render_tile(t, world, *light_picker, cam, image, settings);
+            }
+        });
+    };
 
-    // write elemental images (debugging)
-    for (int t = 0; t < nt; t++)
+    auto render_start = std::chrono::steady_clock::now();
+    if (!progressive)
     {
-        char buf[50];
-        sprintf(buf, "out%d.png", t);
-        stbi_write_png(buf, nx, ny, 3, data + t*nx*ny*3, 0);
+        render_pass();
     }
-
-    // combine images
-    float scale = 1.0/nt;
-    for (int j = ny-1; j >= 0; j--)
+    else
     {
-        for (int i = 0; i < nx; i++)
+        // samples are seeded by their index, so the passes add up to the same image
+        // a single render with that many samples would give
+        settings.adaptive = false;
+        settings.ns = pass_samples;
+        while (true)
         {
-            int pix_id = (i+nx*(ny-1)-j*nx)*3;
-            // data[pix_id+0] = data[pix_id+0];
-            // data[pix_id+1] = data[pix_id+1];
-            // data[pix_id+2] = data[pix_id+2];
-            for (int t = 1; t < nt; t++)
-            {
-                // TODO: This summing needs to happen in linear space, not gamma space
-                int offset = t*nx*ny*3;
-                data[pix_id+0] += data[pix_id+offset+0];
-                data[pix_id+1] += data[pix_id+offset+1];
-                data[pix_id+2] += data[pix_id+offset+2];
-            }
-            // data[pix_id+0] = data[pix_id+0] / float(nt);
-            // data[pix_id+1] = data[pix_id+1] / float(nt);
-            // data[pix_id+2] = data[pix_id+2] / float(nt);
+            auto pass_start = std::chrono::steady_clock::now();
+            render_pass();
+            settings.first_sample += pass_samples;
+            auto pass_end = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(pass_end - frame_start).count();
+            double pass_time = std::chrono::duration<double>(pass_end - pass_start).count();
+            float error = image.mean_error();
+            std::cerr << "\r" << settings.first_sample << " spp, error " << error << ", " << elapsed << " s" << std::flush;
+            if (target_error > 0 && error <= target_error) break;
+            if (time_budget > 0 && elapsed + pass_time > time_budget) break;
+            if (settings.first_sample >= max_samples) break;
         }
+        std::cerr << std::endl;
     }
+    auto render_end = std::chrono::steady_clock::now();
+    std::cerr << "render time: " << std::chrono::duration<double>(render_end - render_start).count() << " s" << std::endl;
 
     // write buffer to file
+    unsigned char *data = new unsigned char[nx*ny*3];
+    image.write_rgb8(data);
     stbi_write_png("out.png", nx, ny, 3, data, 0);
     delete [] data;
+
+    if (settings.adaptive && write_sample_map)
+    {
+        unsigned char *counts = new unsigned char[nx*ny];
+        image.write_counts(counts, max_samples);
+        stbi_write_png("samples.png", nx, ny, 1, counts, 0);
+        delete [] counts;
+    }
 }
\ No newline at end of file
@@ -2,35 +2,50 @@
 #define MATERIALH
 
 #include "texture.h"
+#include "sampler.h"
 
-// choose a random vector in the unit sphere
-vec3 random_in_unit_sphere()
+// concrete material classes, renderers that batch hits group them by this and call
+// the class's methods directly. the listed classes are final, so no subclass can
+// inherit their kind and be shaded with their methods. the rest is MATERIAL_OTHER
+enum material_kind
 {
-    vec3 p;
-    do {
-        p = 2.0*vec3(drand48(),drand48(),drand48()) - vec3(1,1,1);
-    } while (p.squared_length() >= 1.0);
-    return p;
-}
+    MATERIAL_LAMBERTIAN,
+    MATERIAL_METAL,
+    MATERIAL_DIELECTRIC,
+    MATERIAL_DIFFUSE_LIGHT,
+    MATERIAL_OTHER,
+    MATERIAL_KIND_COUNT
+};
 
 // abstract class
 class material
 {
     public:
-        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const = 0;
+        virtual material_kind kind() const {return MATERIAL_OTHER;}
+        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rnd) const = 0;
         virtual vec3 emitted(float u, float v, const vec3& p) const {return vec3(0,0,0);}
+        virtual bool is_emissive() const {return false;}
+        // density (per solid angle) of scatter() picking the direction of scattered.
+        // attenuation*scattering_pdf is then the BSDF times the cosine, so these
+        // materials can be light sampled. 0 for mirror-like materials (metal, glass)
+        virtual float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {return 0;}
 };
 
-class lambertian : public material {
+class lambertian final : public material {
     public:
         lambertian(texture *a) : albedo(a) {}
-        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
+        virtual material_kind kind() const {return MATERIAL_LAMBERTIAN;}
+        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rnd) const
         {
-            vec3 target = rec.p + rec.normal + random_in_unit_sphere();
-            scattered = ray(rec.p, target - rec.p);
+            scattered = ray(rec.p, random_cosine_direction(rec.normal, rnd));
             attenuation = albedo->value(0,0, rec.p);
             return true;
         }
+        virtual float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const
+        {
+            float cosine = dot(rec.normal, unit_vector(scattered.direction()));
+            return cosine < 0 ? 0 : cosine / M_PI;
+        }
 
         texture *albedo;
 };
@@ -40,13 +55,14 @@ vec3 reflect(const vec3& v, const vec3& n)
     return v - 2*dot(v,n)*n;
 }
 
-class metal : public material {
+class metal final : public material {
     public:
         metal(texture *a, float f) : albedo(a) { if (f<1) fuzz = f; else fuzz = 1; }
-        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
+        virtual material_kind kind() const {return MATERIAL_METAL;}
+        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rnd) const
         {
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
+            scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(rnd));
             attenuation = albedo->value(0,0, rec.p);
             return (dot(scattered.direction(), rec.normal) > 0);
         }
@@ -80,11 +96,12 @@ float schlick(float cosine, float ref_idx)
     return r0 + (1-r0)*pow((1-cosine),5);
 }
 
-class dielectric : public material
+class dielectric final : public material
 {
     public:
         dielectric(float ri) : ref_idx(ri) {}
-        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
+        virtual material_kind kind() const {return MATERIAL_DIELECTRIC;}
+        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rnd) const
         {
             vec3 outward_normal;
             vec3 reflected = reflect(r_in.direction(), rec.normal);
@@ -117,7 +134,7 @@ class dielectric : public material
                 reflect_prob = 1.0;
             }
             //choose either reflect or refract based on probability
-            if (drand48() < reflect_prob)
+            if (rnd.next_float() < reflect_prob)
             {
                 scattered = ray(rec.p, reflected);
             }
@@ -132,11 +149,12 @@ class dielectric : public material
 };
 
 // diffuse light emits light and scatters nothing
-class diffuse_light : public material
+class diffuse_light final : public material
 {
     public:
         diffuse_light(texture *a) : emit(a) {}
-        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const
+        virtual material_kind kind() const {return MATERIAL_DIFFUSE_LIGHT;}
+        virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rnd) const
         {
             return false;
         }
@@ -145,6 +163,7 @@ class diffuse_light : public material
             // return emit;
             return emit->value(u,v,p);
         }
+        virtual bool is_emissive() const {return true;}
 
         // vec3 emit;
         texture *emit;
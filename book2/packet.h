@@ -0,0 +1,166 @@
+#ifndef PACKETH
+#define PACKETH
+
+#include "aabb.h"
+#include "simd.h"
+
+// rays traced together through hit_packet, processed simd_width lanes at a time
+const int packet_size = 8;
+
+// packet_size rays as arrays of components. every lane holds a valid ray, rays that
+// are not traced are masked out and can be copies of another one. the inverse
+// directions and ranges are only worked out by prepare(), which the traversals call,
+// so a packet that only meets a single primitive (an instanced sphere) skips them.
+struct alignas(32) ray_packet
+{
+    void set(int k, const ray& r)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            org[a][k] = r.origin()[a];
+            dir[a][k] = r.direction()[a];
+        }
+        prepared = false;
+    }
+    ray get(int k) const
+    {
+        return ray(vec3(org[0][k], org[1][k], org[2][k]), vec3(dir[0][k], dir[1][k], dir[2][k]));
+    }
+    void prepare();
+
+    float org[3][packet_size];
+    float dir[3][packet_size];
+    float inv_dir[3][packet_size];
+    float t_max[packet_size];
+    // ranges of the origins and inverse directions over the packet, for interval culling
+    float org_min[3], org_max[3];
+    float inv_min[3], inv_max[3];
+    // only valid if coherent: every direction has the same nonzero signs, so the
+    // packet shares its near and far box planes and its child visit order
+    int dir_is_neg[3];
+    bool coherent;
+    bool prepared;
+};
+
+void ray_packet::prepare()
+{
+    if (prepared) return;
+    prepared = true;
+    coherent = true;
+    for (int a = 0; a < 3; a++)
+    {
+        dir_is_neg[a] = dir[a][0] < 0;
+        org_min[a] = org_max[a] = org[a][0];
+        inv_min[a] = inv_max[a] = 1.0f / dir[a][0];
+        for (int k = 0; k < packet_size; k++)
+        {
+            inv_dir[a][k] = 1.0f / dir[a][k];
+            coherent = coherent && dir[a][k] != 0 && (dir[a][k] < 0) == dir_is_neg[a];
+            org_min[a] = ffmin(org_min[a], org[a][k]);
+            org_max[a] = ffmax(org_max[a], org[a][k]);
+            inv_min[a] = ffmin(inv_min[a], inv_dir[a][k]);
+            inv_max[a] = ffmax(inv_max[a], inv_dir[a][k]);
+        }
+    }
+}
+
+// bounds of the product of two intervals
+inline void interval_mul(float a0, float a1, float b0, float b1, float& lo, float& hi)
+{
+    float p0 = a0*b0, p1 = a0*b1, p2 = a1*b0, p3 = a1*b1;
+    lo = ffmin(ffmin(p0, p1), ffmin(p2, p3));
+    hi = ffmax(ffmax(p0, p1), ffmax(p2, p3));
+}
+
+// rays in mask of a coherent packet that hit the box bounds[2][3], a vector of rays at a time
+inline int packet_rays_hit_box(const float bounds[2][3], const ray_packet& p, int mask, float t_min)
+{
+    typedef vfloat<simd_width> vf;
+    int hits = 0;
+    for (int b = 0; b < packet_size; b += simd_width)
+    {
+        int lanes = (mask >> b) & ((1 << simd_width) - 1);
+        if (!lanes) continue;
+        vf t0 = vf(t_min);
+        vf t1 = vf::load(p.t_max + b);
+        for (int a = 0; a < 3; a++)
+        {
+            vf o = vf::load(p.org[a] + b);
+            vf inv = vf::load(p.inv_dir[a] + b);
+            t0 = vmax(t0, (vf(bounds[p.dir_is_neg[a]][a]) - o) * inv);
+            t1 = vmin(t1, (vf(bounds[1-p.dir_is_neg[a]][a]) - o) * inv);
+        }
+        hits |= (movemask(t0 <= t1) & lanes) << b;
+    }
+    return hits;
+}
+
+// rays in mask of a coherent packet that hit the box bounds[2][3]. interval arithmetic
+// over the packet's origin and direction ranges rejects boxes no ray can hit (the
+// packet's frustum misses them) before the rays are tested one vector at a time
+inline int packet_hits_box(const float bounds[2][3], const ray_packet& p, int mask, float t_min)
+{
+    float entry = t_min;
+    float exit = MAXFLOAT;
+    for (int a = 0; a < 3; a++)
+    {
+        float near = bounds[p.dir_is_neg[a]][a];
+        float far = bounds[1-p.dir_is_neg[a]][a];
+        float lo, hi, unused;
+        interval_mul(near - p.org_max[a], near - p.org_min[a], p.inv_min[a], p.inv_max[a], lo, unused);
+        interval_mul(far - p.org_max[a], far - p.org_min[a], p.inv_min[a], p.inv_max[a], unused, hi);
+        entry = ffmax(entry, lo);
+        exit = ffmin(exit, hi);
+    }
+    if (entry > exit)
+    {
+        return 0;
+    }
+    return packet_rays_hit_box(bounds, p, mask, t_min);
+}
+
+// closest hits of the rays in mask with one sphere, the same roots as sphere::hit.
+// shortens t_max of the rays it hits and returns their mask
+inline int hit_sphere_packet(ray_packet& p, int mask, float t_min, const vec3& center, float radius)
+{
+    typedef vfloat<simd_width> vf;
+    int hits = 0;
+    for (int b = 0; b < packet_size; b += simd_width)
+    {
+        int lanes = (mask >> b) & ((1 << simd_width) - 1);
+        if (!lanes) continue;
+        vf dx = vf::load(p.dir[0] + b);
+        vf dy = vf::load(p.dir[1] + b);
+        vf dz = vf::load(p.dir[2] + b);
+        vf ocx = vf::load(p.org[0] + b) - vf(center.x());
+        vf ocy = vf::load(p.org[1] + b) - vf(center.y());
+        vf ocz = vf::load(p.org[2] + b) - vf(center.z());
+        vf a = dx*dx + dy*dy + dz*dz;
+        vf half_b = ocx*dx + ocy*dy + ocz*dz;
+        vf c = ocx*ocx + ocy*ocy + ocz*ocz - vf(radius*radius);
+        vf discriminant = half_b*half_b - a*c;
+        vmask<simd_width> valid = discriminant > vf(0.0f);
+        if (!(movemask(valid) & lanes)) continue;
+        vf root = vsqrt(vmax(discriminant, vf(0.0f)));
+        vf t0 = (vf(0.0f) - half_b - root) / a;
+        vf t1 = (root - half_b) / a;
+        vf t_max = vf::load(p.t_max + b);
+        vmask<simd_width> m0 = valid & (t0 < t_max) & (t0 > vf(t_min));
+        vmask<simd_width> m1 = valid & (t1 < t_max) & (t1 > vf(t_min));
+        int found = movemask(m0 | m1) & lanes;
+        if (!found) continue;
+        alignas(32) float t[simd_width];
+        select(m0, t0, t1).store(t);
+        for (int l = 0; l < simd_width; l++)
+        {
+            if ((found >> l) & 1)
+            {
+                p.t_max[b + l] = t[l];
+            }
+        }
+        hits |= found << b;
+    }
+    return hits;
+}
+
+#endif //PACKETH
@@ -0,0 +1,164 @@
+#ifndef PARALLELH
+#define PARALLELH
+
+#include <pthread.h>
+
+// splits [0,n) into nt contiguous chunks and calls body(begin, end, thread)
+// for each one on its own pthread, the last chunk runs on the calling thread
+template <class F>
+struct parallel_for_task
+{
+    const F *body;
+    int begin, end, thread;
+};
+
+template <class F>
+void *parallel_for_thread(void *arg)
+{
+    parallel_for_task<F> *task = (parallel_for_task<F> *)arg;
+    (*task->body)(task->begin, task->end, task->thread);
+    return NULL;
+}
+
+template <class F>
+void parallel_for(int n, int nt, const F& body)
+{
+    if (nt > n) nt = n;
+    if (nt <= 1)
+    {
+        body(0, n, 0);
+        return;
+    }
+
+    parallel_for_task<F> *tasks = new parallel_for_task<F>[nt];
+    pthread_t *threads = new pthread_t[nt];
+    bool *started = new bool[nt];
+    for (int t = 0; t < nt; t++)
+    {
+        tasks[t].body = &body;
+        tasks[t].begin = int((long long)n * t / nt);
+        tasks[t].end = int((long long)n * (t+1) / nt);
+        tasks[t].thread = t;
+    }
+    for (int t = 0; t < nt-1; t++)
+    {
+        // if no thread can be created, run the chunk here instead
+        started[t] = pthread_create(&threads[t], NULL, parallel_for_thread<F>, (void *)&tasks[t]) == 0;
+        if (!started[t])
+        {
+            parallel_for_thread<F>((void *)&tasks[t]);
+        }
+    }
+    parallel_for_thread<F>((void *)&tasks[nt-1]);
+    for (int t = 0; t < nt-1; t++)
+    {
+        if (started[t])
+        {
+            pthread_join(threads[t], NULL);
+        }
+    }
+    delete [] started;
+    delete [] threads;
+    delete [] tasks;
+}
+
+// threads that run one body together for a whole job, for work in many short stages
+// where starting threads for every stage (parallel_for) costs more than the stage.
+// the body separates its stages with sync(), a barrier for every member
+struct thread_team
+{
+    int size;
+    int arrived;
+    int generation;
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+
+    // waits until every member got here
+    void sync()
+    {
+        pthread_mutex_lock(&lock);
+        int g = generation;
+        if (++arrived == size)
+        {
+            arrived = 0;
+            generation++;
+            pthread_cond_broadcast(&released);
+        }
+        else
+        {
+            while (g == generation)
+            {
+                pthread_cond_wait(&released, &lock);
+            }
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+    // the part [begin, end) of n items that member thread takes, split like parallel_for
+    void range(int n, int thread, int& begin, int& end) const
+    {
+        begin = int((long long)n * thread / size);
+        end = int((long long)n * (thread+1) / size);
+    }
+};
+
+template <class F>
+struct parallel_team_task
+{
+    const F *body;
+    thread_team *team;
+    int thread;
+};
+
+template <class F>
+void *parallel_team_thread(void *arg)
+{
+    parallel_team_task<F> *task = (parallel_team_task<F> *)arg;
+    // the team's size is only known once the calling thread gets here too
+    task->team->sync();
+    (*task->body)(task->thread, *task->team);
+    return NULL;
+}
+
+// calls body(thread, team) on a team of up to nt threads, the calling thread is the last member
+template <class F>
+void parallel_team(int nt, const F& body)
+{
+    if (nt < 1) nt = 1;
+    thread_team team;
+    team.size = nt;
+    team.arrived = 0;
+    team.generation = 0;
+    pthread_mutex_init(&team.lock, NULL);
+    pthread_cond_init(&team.released, NULL);
+    parallel_team_task<F> *tasks = new parallel_team_task<F>[nt];
+    pthread_t *threads = new pthread_t[nt];
+    int started = 0;
+    while (started < nt-1)
+    {
+        tasks[started].body = &body;
+        tasks[started].team = &team;
+        tasks[started].thread = started;
+        if (pthread_create(&threads[started], NULL, parallel_team_thread<F>, (void *)&tasks[started]) != 0)
+        {
+            // the team goes on without the members that could not be started
+            break;
+        }
+        started++;
+    }
+    pthread_mutex_lock(&team.lock);
+    team.size = started + 1;
+    pthread_mutex_unlock(&team.lock);
+    team.sync();
+    body(started, team);
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    delete [] threads;
+    delete [] tasks;
+    pthread_cond_destroy(&team.released);
+    pthread_mutex_destroy(&team.lock);
+}
+
+#endif //PARALLELH
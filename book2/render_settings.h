@@ -0,0 +1,31 @@
+#ifndef RENDERSETTINGSH
+#define RENDERSETTINGSH
+
+#include <stdint.h>
+#include "sampler.h"
+
+// everything the renderer needs besides the scene and the camera
+struct render_settings
+{
+    int ns;        // samples per pixel, the average over the frame in adaptive mode
+    int max_depth; // bounces before a path is cut off
+    int rr_depth;  // bounces before russian roulette starts
+    bool light_sampling; // sample emitters directly at diffuse hits
+    // adaptive sampling, per pixel sample counts between min_samples and max_samples
+    // within a budget of ns samples per pixel for the whole frame
+    bool adaptive;
+    int min_samples;
+    int max_samples;
+    int batch_samples; // samples a round of adaptive sampling gives a noisy pixel
+    float max_error;   // relative standard error of the pixel mean to stop at
+    sampler_type sampling; // where the random numbers of a sample come from
+    int frame;
+    uint64_t seed;
+    int first_sample; // index of the first sample, later passes continue where the last stopped
+    bool reorder_rays; // wavefront mode sorts secondary rays by direction and origin before tracing
+    // samples to add to each pixel in this pass, continuing from the pixel's count in
+    // the film. NULL gives every pixel ns samples from first_sample on
+    const int *pixel_samples;
+};
+
+#endif //RENDERSETTINGSH
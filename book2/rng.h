@@ -0,0 +1,57 @@
+#ifndef RNGH
+#define RNGH
+
+#include <stdint.h>
+
+// PCG32 by Melissa O'Neill, 64 bit state and 32 bit output. each thread or tile
+// owns one and passes it down by reference, so sampling never touches shared state.
+// different stream values give independent sequences for the same seed.
+class rng
+{
+    public:
+        rng() { seed(0, 0); }
+        rng(uint64_t s, uint64_t stream) { seed(s, stream); }
+        void seed(uint64_t s, uint64_t stream)
+        {
+            state = 0;
+            inc = (stream << 1) | 1;
+            next_uint();
+            state += s;
+            next_uint();
+        }
+        uint32_t next_uint()
+        {
+            uint64_t old = state;
+            state = old * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+            uint32_t rot = uint32_t(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+        }
+        // uniform in [0, 1), the top 24 bits so it never rounds up to 1
+        float next_float()
+        {
+            return float(next_uint() >> 8) * (1.0f / 16777216.0f);
+        }
+
+        uint64_t state;
+        uint64_t inc;
+};
+
+// splitmix64 finalizer, every input bit affects every output bit
+inline uint64_t mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// seed for one sample of one pixel. it only depends on these values, not on which
+// thread or tile renders the sample, so images match for any thread count or split
+inline uint64_t sample_seed(int x, int y, int sample, int frame, uint64_t seed)
+{
+    uint64_t h = mix64(seed + 0x9e3779b97f4a7c15ULL);
+    h = mix64(h ^ (uint64_t(uint32_t(x)) | (uint64_t(uint32_t(y)) << 32)));
+    return mix64(h ^ (uint64_t(uint32_t(sample)) | (uint64_t(uint32_t(frame)) << 32)));
+}
+
+#endif //RNGH
@@ -0,0 +1,208 @@
+#ifndef SAMPLERH
+#define SAMPLERH
+
+#include "ray.h"
+#include "rng.h"
+
+// dimension layout of one camera sample. every bounce gets the same block, so a
+// dimension means the same thing in every sample of every pixel
+const int camera_dimensions = 4;  // pixel x, y, lens u, v
+const int bounce_dimensions = 8;
+// offsets inside a bounce block
+const int bsdf_dimension = 0;     // up to 4 for scatter()
+const int light_pick_dimension = 4;
+const int roulette_dimension = 5;
+const int light_dimension = 6;    // direction toward the picked light
+
+inline int bounce_dimension(int depth, int offset)
+{
+    return camera_dimensions + depth*bounce_dimensions + offset;
+}
+
+// source of the random numbers of one sample. start_sample() begins sample index of
+// pixel (x, y), start_dimensions() moves to the count dimensions at first. numbers
+// drawn past those come from an independent generator, so code that needs a varying
+// amount of them (rejection loops) never takes numbers meant for something else
+class sampler
+{
+    public:
+        sampler(int f, uint64_t s) : frame(f), seed(s) {}
+        virtual ~sampler() {}
+        virtual void start_sample(int x, int y, int index)
+        {
+            rnd.seed(sample_seed(x, y, index, frame, seed), 0);
+            start_dimensions(0, camera_dimensions);
+        }
+        void start_dimensions(int first, int count)
+        {
+            dimension = first;
+            end = first + count;
+        }
+        virtual float next_float() = 0;
+
+        int frame;
+        uint64_t seed;
+        int dimension, end;
+        rng rnd;
+};
+
+// plain uniform random numbers, every dimension independent
+class independent_sampler : public sampler
+{
+    public:
+        independent_sampler(int f, uint64_t s) : sampler(f, s) {}
+        virtual float next_float()
+        {
+            return rnd.next_float();
+        }
+};
+
+inline uint32_t reverse_bits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+// hash that only lets lower bits change higher ones (Laine and Karras)
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// first two sobol dimensions of a sample, with the bits of the fractions reversed
+// (bit 0 is the 1/2 place), the form owen scrambling works on. the first is van der
+// Corput, which reversed is the index itself. the second comes from the polynomial
+// x + 1, its bit j is the xor of the index bits i with j a subset of i (pascal's
+// triangle mod 2)
+inline void sobol_2d_reversed(uint32_t index, uint32_t& x, uint32_t& y)
+{
+    x = index;
+    y = index;
+    y ^= (y >> 1) & 0x55555555;
+    y ^= (y >> 2) & 0x33333333;
+    y ^= (y >> 4) & 0x0f0f0f0f;
+    y ^= (y >> 8) & 0x00ff00ff;
+    y ^= (y >> 16) & 0x0000ffff;
+}
+
+// owen scrambled sobol points. dimensions are used in pairs, each pair is a 2D sobol
+// set with its own scramble and its own shuffle of the sample index, seeded from the
+// pixel. pairs are well stratified on their own, and any number of them is available
+// without direction number tables (padding). the first 2^k samples of a pixel are
+// stratified, so powers of two are the best sample counts
+class sobol_sampler : public sampler
+{
+    public:
+        sobol_sampler(int f, uint64_t s) : sampler(f, s) {}
+        virtual void start_sample(int x, int y, int index)
+        {
+            sampler::start_sample(x, y, index);
+            pixel_seed = sample_seed(x, y, -1, frame, seed);
+            index_reversed = reverse_bits(uint32_t(index));
+            cached_pair = -1;
+        }
+        virtual float next_float()
+        {
+            if (dimension >= end)
+            {
+                return rnd.next_float();
+            }
+            int pair = dimension / 2;
+            if (pair != cached_pair)
+            {
+                uint64_t h0 = mix64(pixel_seed ^ (uint64_t(pair) * 0x9e3779b97f4a7c15ULL));
+                uint64_t h1 = mix64(h0);
+                // owen scrambling shuffles the index and then scrambles both coordinates
+                // (Burley, practical hash-based owen scrambling)
+                uint32_t index = reverse_bits(laine_karras_permutation(index_reversed, uint32_t(h0)));
+                uint32_t x, y;
+                sobol_2d_reversed(index, x, y);
+                values[0] = reverse_bits(laine_karras_permutation(x, uint32_t(h0 >> 32)));
+                values[1] = reverse_bits(laine_karras_permutation(y, uint32_t(h1)));
+                cached_pair = pair;
+            }
+            uint32_t value = values[dimension & 1];
+            dimension++;
+            return float(value >> 8) * (1.0f / 16777216.0f);
+        }
+
+        uint64_t pixel_seed;
+        uint32_t index_reversed;
+        int cached_pair;
+        uint32_t values[2];
+};
+
+enum sampler_type
+{
+    SAMPLER_INDEPENDENT,
+    SAMPLER_SOBOL
+};
+
+sampler *new_sampler(sampler_type type, int frame, uint64_t seed)
+{
+    if (type == SAMPLER_SOBOL)
+    {
+        return new sobol_sampler(frame, seed);
+    }
+    return new independent_sampler(frame, seed);
+}
+
+// closed form warps from the unit square, two or three numbers each and no rejection
+// loops, so they use a fixed number of dimensions and keep the points stratified
+
+// concentric mapping of the square onto the unit disk (Shirley and Chiu), the point
+// in the z = 0 plane
+inline vec3 random_in_unit_disk(sampler& rnd)
+{
+    float a = 2.0f*rnd.next_float() - 1.0f;
+    float b = 2.0f*rnd.next_float() - 1.0f;
+    bool outer_x = fabs(a) > fabs(b);
+    float r = outer_x ? a : b;
+    float phi = r == 0 ? 0 : outer_x ? float(M_PI/4)*(b/a) : float(M_PI/2) - float(M_PI/4)*(a/b);
+    return vec3(r*cos(phi), r*sin(phi), 0);
+}
+
+// direction uniform over the unit sphere
+inline vec3 random_unit_vector(sampler& rnd)
+{
+    float z = 1.0f - 2.0f*rnd.next_float();
+    float phi = 2.0f*float(M_PI)*rnd.next_float();
+    float r = sqrt(fmax(0.0f, 1.0f - z*z));
+    return vec3(r*cos(phi), r*sin(phi), z);
+}
+
+// point uniform in the unit ball, a direction and a radius with density r^2
+inline vec3 random_in_unit_sphere(sampler& rnd)
+{
+    vec3 dir = random_unit_vector(rnd);
+    return cbrt(rnd.next_float()) * dir;
+}
+
+// w turned from the z axis onto the unit vector n
+inline vec3 from_local(const vec3& n, const vec3& w)
+{
+    vec3 a = fabs(n.x()) > 0.9 ? vec3(0,1,0) : vec3(1,0,0);
+    vec3 t = unit_vector(cross(n, a));
+    vec3 b = cross(n, t);
+    return w.x()*t + w.y()*b + w.z()*n;
+}
+
+// cosine distributed direction around the unit vector n, a point on the disk lifted
+// onto the hemisphere (Malley's method). density cos(theta) / pi
+inline vec3 random_cosine_direction(const vec3& n, sampler& rnd)
+{
+    vec3 d = random_in_unit_disk(rnd);
+    float z = sqrt(fmax(0.0f, 1.0f - d.x()*d.x() - d.y()*d.y()));
+    return from_local(n, vec3(d.x(), d.y(), z));
+}
+
+#endif //SAMPLERH
@@ -0,0 +1,136 @@
+#ifndef SCHEDULERH
+#define SCHEDULERH
+
+#include <pthread.h>
+#include "parallel.h"
+
+// image region [x0, x1) x [y0, y1), index is its place in the tile order
+struct tile
+{
+    int x0, y0, x1, y1;
+    int index;
+};
+
+// the tiles a thread still owns, a range [begin, end) of the tile order.
+// the owner takes from the front, thieves split off the back half.
+struct alignas(64) tile_range
+{
+    pthread_mutex_t lock;
+    int begin, end;
+};
+
+// splits the image into tiles and hands them out through per-thread ranges with
+// work stealing. every tile is given out exactly once, so each pixel is rendered once.
+class tile_scheduler
+{
+    public:
+        tile_scheduler(int nx, int ny, int tile_size, int nt);
+        ~tile_scheduler();
+        bool next_tile(int thread, tile& t);
+        bool steal(int thread);
+        // calls render(tile, thread) on nt threads until every tile is done
+        template <class F>
+        void run(const F& render);
+
+        int nx, ny, tile_size;
+        int tiles_x, tiles_y, tile_count;
+        int nt;
+        tile_range *ranges;
+};
+
+tile_scheduler::tile_scheduler(int w, int h, int size, int threads)
+{
+    nx = w;
+    ny = h;
+    tile_size = size;
+    nt = threads;
+    tiles_x = (nx + tile_size - 1) / tile_size;
+    tiles_y = (ny + tile_size - 1) / tile_size;
+    tile_count = tiles_x * tiles_y;
+    // contiguous blocks of tiles to start with, neighbouring tiles stay on one thread
+    ranges = new tile_range[nt];
+    for (int t = 0; t < nt; t++)
+    {
+        pthread_mutex_init(&ranges[t].lock, NULL);
+        ranges[t].begin = int((long long)tile_count * t / nt);
+        ranges[t].end = int((long long)tile_count * (t+1) / nt);
+    }
+}
+
+tile_scheduler::~tile_scheduler()
+{
+    for (int t = 0; t < nt; t++)
+    {
+        pthread_mutex_destroy(&ranges[t].lock);
+    }
+    delete [] ranges;
+}
+
+bool tile_scheduler::next_tile(int thread, tile& t)
+{
+    tile_range& own = ranges[thread];
+    while (true)
+    {
+        pthread_mutex_lock(&own.lock);
+        int index = own.begin < own.end ? own.begin++ : -1;
+        pthread_mutex_unlock(&own.lock);
+        if (index >= 0)
+        {
+            int tx = index % tiles_x;
+            int ty = index / tiles_x;
+            t.x0 = tx * tile_size;
+            t.y0 = ty * tile_size;
+            t.x1 = t.x0 + tile_size < nx ? t.x0 + tile_size : nx;
+            t.y1 = t.y0 + tile_size < ny ? t.y0 + tile_size : ny;
+            t.index = index;
+            return true;
+        }
+        if (!steal(thread))
+        {
+            return false;
+        }
+    }
+}
+
+// moves the back half of the first non empty range after ours into ours.
+// only fails once every range is empty, tiles never come back after that.
+bool tile_scheduler::steal(int thread)
+{
+    for (int i = 1; i < nt; i++)
+    {
+        tile_range& victim = ranges[(thread + i) % nt];
+        pthread_mutex_lock(&victim.lock);
+        int count = victim.end - victim.begin;
+        int begin = victim.end - (count + 1) / 2;
+        int end = victim.end;
+        if (count > 0)
+        {
+            victim.end = begin;
+        }
+        pthread_mutex_unlock(&victim.lock);
+        if (count > 0)
+        {
+            tile_range& own = ranges[thread];
+            pthread_mutex_lock(&own.lock);
+            own.begin = begin;
+            own.end = end;
+            pthread_mutex_unlock(&own.lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <class F>
+void tile_scheduler::run(const F& render)
+{
+    parallel_for(nt, nt, [&](int begin, int end, int thread) {
+        tile t;
+        while (next_tile(thread, t))
+        {
+            render(t, thread);
+        }
+    });
+}
+
+#endif //SCHEDULERH
@@ -0,0 +1,154 @@
+#ifndef SIMDH
+#define SIMDH
+
+#include <math.h>
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// W wide float vectors and lane masks used by the wide BVH kernels.
+// the generic version is plain arrays (the compiler may still vectorize it),
+// SSE and AVX versions are used when the compiler targets them (-msse2, -mavx2)
+
+template <int W>
+struct vmask
+{
+    unsigned bits;
+};
+
+template <int W>
+struct vfloat
+{
+    vfloat() {}
+    vfloat(float f) { for (int i = 0; i < W; i++) v[i] = f; }
+    static vfloat load(const float *p) { vfloat r; for (int i = 0; i < W; i++) r.v[i] = p[i]; return r; }
+    static vfloat loadu(const float *p) { return load(p); }
+    static vfloat lane_index() { vfloat r; for (int i = 0; i < W; i++) r.v[i] = float(i); return r; }
+    void store(float *p) const { for (int i = 0; i < W; i++) p[i] = v[i]; }
+    float operator[](int i) const { return v[i]; }
+
+    float v[W];
+};
+
+#define VFLOAT_GENERIC_OP(OP) \
+template <int W> inline vfloat<W> operator OP(const vfloat<W>& a, const vfloat<W>& b) \
+{ vfloat<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] OP b.v[i]; return r; }
+VFLOAT_GENERIC_OP(+)
+VFLOAT_GENERIC_OP(-)
+VFLOAT_GENERIC_OP(*)
+VFLOAT_GENERIC_OP(/)
+#undef VFLOAT_GENERIC_OP
+
+#define VFLOAT_GENERIC_CMP(OP) \
+template <int W> inline vmask<W> operator OP(const vfloat<W>& a, const vfloat<W>& b) \
+{ vmask<W> r; r.bits = 0; for (int i = 0; i < W; i++) r.bits |= (a.v[i] OP b.v[i]) << i; return r; }
+VFLOAT_GENERIC_CMP(<)
+VFLOAT_GENERIC_CMP(<=)
+VFLOAT_GENERIC_CMP(>)
+VFLOAT_GENERIC_CMP(>=)
+#undef VFLOAT_GENERIC_CMP
+
+template <int W> inline vfloat<W> vmin(const vfloat<W>& a, const vfloat<W>& b)
+{ vfloat<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+template <int W> inline vfloat<W> vmax(const vfloat<W>& a, const vfloat<W>& b)
+{ vfloat<W> r; for (int i = 0; i < W; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+template <int W> inline vfloat<W> vsqrt(const vfloat<W>& a)
+{ vfloat<W> r; for (int i = 0; i < W; i++) r.v[i] = sqrtf(a.v[i]); return r; }
+template <int W> inline vfloat<W> select(const vmask<W>& m, const vfloat<W>& a, const vfloat<W>& b)
+{ vfloat<W> r; for (int i = 0; i < W; i++) r.v[i] = (m.bits >> i) & 1 ? a.v[i] : b.v[i]; return r; }
+template <int W> inline vmask<W> operator&(const vmask<W>& a, const vmask<W>& b) { vmask<W> r; r.bits = a.bits & b.bits; return r; }
+template <int W> inline vmask<W> operator|(const vmask<W>& a, const vmask<W>& b) { vmask<W> r; r.bits = a.bits | b.bits; return r; }
+template <int W> inline int movemask(const vmask<W>& m) { return m.bits; }
+
+#if defined(__SSE2__)
+template <>
+struct vmask<4>
+{
+    __m128 m;
+};
+
+template <>
+struct vfloat<4>
+{
+    vfloat() {}
+    vfloat(__m128 a) : m(a) {}
+    vfloat(float f) : m(_mm_set1_ps(f)) {}
+    static vfloat load(const float *p) { return vfloat(_mm_load_ps(p)); }
+    static vfloat loadu(const float *p) { return vfloat(_mm_loadu_ps(p)); }
+    static vfloat lane_index() { return vfloat(_mm_set_ps(3, 2, 1, 0)); }
+    void store(float *p) const { _mm_store_ps(p, m); }
+    float operator[](int i) const { float v[4]; _mm_storeu_ps(v, m); return v[i]; }
+
+    __m128 m;
+};
+
+inline vfloat<4> operator+(const vfloat<4>& a, const vfloat<4>& b) { return _mm_add_ps(a.m, b.m); }
+inline vfloat<4> operator-(const vfloat<4>& a, const vfloat<4>& b) { return _mm_sub_ps(a.m, b.m); }
+inline vfloat<4> operator*(const vfloat<4>& a, const vfloat<4>& b) { return _mm_mul_ps(a.m, b.m); }
+inline vfloat<4> operator/(const vfloat<4>& a, const vfloat<4>& b) { return _mm_div_ps(a.m, b.m); }
+inline vmask<4> operator<(const vfloat<4>& a, const vfloat<4>& b) { vmask<4> r; r.m = _mm_cmplt_ps(a.m, b.m); return r; }
+inline vmask<4> operator<=(const vfloat<4>& a, const vfloat<4>& b) { vmask<4> r; r.m = _mm_cmple_ps(a.m, b.m); return r; }
+inline vmask<4> operator>(const vfloat<4>& a, const vfloat<4>& b) { vmask<4> r; r.m = _mm_cmpgt_ps(a.m, b.m); return r; }
+inline vmask<4> operator>=(const vfloat<4>& a, const vfloat<4>& b) { vmask<4> r; r.m = _mm_cmpge_ps(a.m, b.m); return r; }
+inline vfloat<4> vmin(const vfloat<4>& a, const vfloat<4>& b) { return _mm_min_ps(a.m, b.m); }
+inline vfloat<4> vmax(const vfloat<4>& a, const vfloat<4>& b) { return _mm_max_ps(a.m, b.m); }
+inline vfloat<4> vsqrt(const vfloat<4>& a) { return _mm_sqrt_ps(a.m); }
+inline vfloat<4> select(const vmask<4>& m, const vfloat<4>& a, const vfloat<4>& b)
+{
+    return _mm_or_ps(_mm_and_ps(m.m, a.m), _mm_andnot_ps(m.m, b.m));
+}
+inline vmask<4> operator&(const vmask<4>& a, const vmask<4>& b) { vmask<4> r; r.m = _mm_and_ps(a.m, b.m); return r; }
+inline vmask<4> operator|(const vmask<4>& a, const vmask<4>& b) { vmask<4> r; r.m = _mm_or_ps(a.m, b.m); return r; }
+inline int movemask(const vmask<4>& m) { return _mm_movemask_ps(m.m); }
+#endif
+
+#if defined(__AVX__)
+template <>
+struct vmask<8>
+{
+    __m256 m;
+};
+
+template <>
+struct vfloat<8>
+{
+    vfloat() {}
+    vfloat(__m256 a) : m(a) {}
+    vfloat(float f) : m(_mm256_set1_ps(f)) {}
+    static vfloat load(const float *p) { return vfloat(_mm256_load_ps(p)); }
+    static vfloat loadu(const float *p) { return vfloat(_mm256_loadu_ps(p)); }
+    static vfloat lane_index() { return vfloat(_mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0)); }
+    void store(float *p) const { _mm256_store_ps(p, m); }
+    float operator[](int i) const { float v[8]; _mm256_storeu_ps(v, m); return v[i]; }
+
+    __m256 m;
+};
+
+inline vfloat<8> operator+(const vfloat<8>& a, const vfloat<8>& b) { return _mm256_add_ps(a.m, b.m); }
+inline vfloat<8> operator-(const vfloat<8>& a, const vfloat<8>& b) { return _mm256_sub_ps(a.m, b.m); }
+inline vfloat<8> operator*(const vfloat<8>& a, const vfloat<8>& b) { return _mm256_mul_ps(a.m, b.m); }
+inline vfloat<8> operator/(const vfloat<8>& a, const vfloat<8>& b) { return _mm256_div_ps(a.m, b.m); }
+inline vmask<8> operator<(const vfloat<8>& a, const vfloat<8>& b) { vmask<8> r; r.m = _mm256_cmp_ps(a.m, b.m, _CMP_LT_OQ); return r; }
+inline vmask<8> operator<=(const vfloat<8>& a, const vfloat<8>& b) { vmask<8> r; r.m = _mm256_cmp_ps(a.m, b.m, _CMP_LE_OQ); return r; }
+inline vmask<8> operator>(const vfloat<8>& a, const vfloat<8>& b) { vmask<8> r; r.m = _mm256_cmp_ps(a.m, b.m, _CMP_GT_OQ); return r; }
+inline vmask<8> operator>=(const vfloat<8>& a, const vfloat<8>& b) { vmask<8> r; r.m = _mm256_cmp_ps(a.m, b.m, _CMP_GE_OQ); return r; }
+inline vfloat<8> vmin(const vfloat<8>& a, const vfloat<8>& b) { return _mm256_min_ps(a.m, b.m); }
+inline vfloat<8> vmax(const vfloat<8>& a, const vfloat<8>& b) { return _mm256_max_ps(a.m, b.m); }
+inline vfloat<8> vsqrt(const vfloat<8>& a) { return _mm256_sqrt_ps(a.m); }
+inline vfloat<8> select(const vmask<8>& m, const vfloat<8>& a, const vfloat<8>& b)
+{
+    return _mm256_blendv_ps(b.m, a.m, m.m);
+}
+inline vmask<8> operator&(const vmask<8>& a, const vmask<8>& b) { vmask<8> r; r.m = _mm256_and_ps(a.m, b.m); return r; }
+inline vmask<8> operator|(const vmask<8>& a, const vmask<8>& b) { vmask<8> r; r.m = _mm256_or_ps(a.m, b.m); return r; }
+inline int movemask(const vmask<8>& m) { return _mm256_movemask_ps(m.m); }
+#endif
+
+// widest vector the compiler targets
+#if defined(__AVX__)
+static const int simd_width = 8;
+#else
+static const int simd_width = 4;
+#endif
+
+#endif //SIMDH
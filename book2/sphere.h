@@ -9,6 +9,10 @@ class sphere: public hitable
         sphere() {}
         sphere(vec3 cen, float r, material *m) : center(cen), radius(r) {mat_ptr = m;}
         virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual void finalize(const ray& r, hit_record& rec) const;
+        virtual int hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const;
         vec3 center;
         float radius;
         material *mat_ptr;
@@ -23,26 +27,89 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
     float discriminant = b*b - a*c;
     if (discriminant > 0)
     {
-        float temp = (-b - sqrt(b*b-a*c))/a;
+        float root = sqrt(discriminant);
+        float temp = (-b - root)/a;
         if (temp < t_max && temp > t_min)
         {
             rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.obj = this;
+            rec.prim_id = 0;
+            rec.inst = NULL;
             return true;
         }
-        temp = (-b + sqrt(b*b-a*c))/a;
+        temp = (-b + root)/a;
         if (temp < t_max && temp > t_min)
         {
             rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            rec.obj = this;
+            rec.prim_id = 0;
+            rec.inst = NULL;
             return true;
         }
     }
     return false;
 }
 
+int sphere::hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const
+{
+    int hits = hit_sphere_packet(p, mask, t_min, center, radius);
+    for (int k = 0; k < packet_size; k++)
+    {
+        if ((hits >> k) & 1)
+        {
+            recs[k].t = p.t_max[k];
+            recs[k].obj = this;
+            recs[k].prim_id = 0;
+            recs[k].inst = NULL;
+        }
+    }
+    return hits;
+}
+
+void get_sphere_uv(const vec3& p, float& u, float& v)
+{
+    float phi = atan2(p.z(), p.x());
+    float theta = asin(p.y());
+    u = 1-(phi + M_PI) / (2*M_PI);
+    v = (theta + M_PI/2) / M_PI;
+}
+
+void sphere::finalize(const ray& r, hit_record& rec) const
+{
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = (rec.p - center) / radius;
+    get_sphere_uv(rec.normal, rec.u, rec.v);
+    rec.mat_ptr = mat_ptr;
+}
+
+// same roots as hit, without the point, normal and material
+bool sphere::occluded(const ray& r, float t_min, float t_max) const
+{
+    vec3 oc = r.origin() - center;
+    float a = dot(r.direction(), r.direction());
+    float b = dot(oc, r.direction());
+    float c = dot(oc, oc) - radius*radius;
+    float discriminant = b*b - a*c;
+    if (discriminant > 0)
+    {
+        float root = sqrt(discriminant);
+        float temp = (-b - root)/a;
+        if (temp < t_max && temp > t_min)
+        {
+            return true;
+        }
+        temp = (-b + root)/a;
+        return temp < t_max && temp > t_min;
+    }
+    return false;
+}
+
+bool sphere::bounding_box(aabb& box) const
+{
+    // negative radius is used for hollow glass, so the extent is |radius|
+    float r = fabs(radius);
+    box = aabb(center - vec3(r, r, r), center + vec3(r, r, r));
+    return true;
+}
+
 #endif //SPHEREH
\ No newline at end of file
@@ -0,0 +1,241 @@
+#ifndef SPHERESOAH
+#define SPHERESOAH
+
+#include <map>
+#include <string.h>
+#include "sphere.h"
+#include "simd.h"
+
+// spheres stored as separate aligned arrays (structure of arrays) so the
+// closest hit can be found 2*simd_width spheres per iteration without any
+// virtual calls. works as a hitable on its own or as BVH leaf storage through
+// hit_range.
+class sphere_soa : public hitable
+{
+    public:
+        sphere_soa() {}
+        sphere_soa(sphere **l, int n);
+        ~sphere_soa();
+        virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual bool bounding_box(aabb& box) const;
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual void finalize(const ray& r, hit_record& rec) const;
+        bool hit_range(const ray& r, float t_min, float t_max, int begin, int end, hit_record& rec) const;
+        bool occluded_range(const ray& r, float t_min, float t_max, int begin, int end) const;
+
+        float *center_x, *center_y, *center_z;
+        float *radius;
+        int *material_index;
+        material **materials;
+        int count;
+        int material_count;
+};
+
+sphere_soa::sphere_soa(sphere **l, int n)
+{
+    count = n;
+    // the kernel reads up to two vectors past the last sphere, pad so that stays in bounds
+    int padded = ((n + 2*simd_width + 15) / 16) * 16;
+    center_x = (float *)aligned_alloc(64, padded*sizeof(float));
+    center_y = (float *)aligned_alloc(64, padded*sizeof(float));
+    center_z = (float *)aligned_alloc(64, padded*sizeof(float));
+    radius = (float *)aligned_alloc(64, padded*sizeof(float));
+    material_index = new int[n];
+
+    // spheres usually share a handful of materials, store each one once. neighbours
+    // mostly have the same one, so the map is only searched when it changes
+    std::map<material *, int> material_ids;
+    material *last_mat = NULL;
+    int last_id = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (l[i]->mat_ptr != last_mat || i == 0)
+        {
+            last_mat = l[i]->mat_ptr;
+            std::map<material *, int>::iterator it = material_ids.find(last_mat);
+            if (it == material_ids.end())
+            {
+                last_id = int(material_ids.size());
+                material_ids[last_mat] = last_id;
+            }
+            else
+            {
+                last_id = it->second;
+            }
+        }
+        material_index[i] = last_id;
+        center_x[i] = l[i]->center.x();
+        center_y[i] = l[i]->center.y();
+        center_z[i] = l[i]->center.z();
+        radius[i] = l[i]->radius;
+    }
+    for (int i = n; i < padded; i++)
+    {
+        center_x[i] = center_y[i] = center_z[i] = radius[i] = 0;
+    }
+    material_count = int(material_ids.size());
+    materials = new material*[material_count];
+    for (std::map<material *, int>::iterator it = material_ids.begin(); it != material_ids.end(); ++it)
+    {
+        materials[it->second] = it->first;
+    }
+}
+
+sphere_soa::~sphere_soa()
+{
+    free(center_x);
+    free(center_y);
+    free(center_z);
+    free(radius);
+    delete [] material_index;
+    delete [] materials;
+}
+
+bool sphere_soa::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    return hit_range(r, t_min, t_max, 0, count, rec);
+}
+
+// the bits of an int in a float lane. select only moves bits, so an index
+// carried like this stays exact where float(i) stops at 2^24
+inline float int_bits(int i)
+{
+    float f;
+    memcpy(&f, &i, sizeof(f));
+    return f;
+}
+
+inline int float_bits(float f)
+{
+    int i;
+    memcpy(&i, &f, sizeof(i));
+    return i;
+}
+
+// one vector of spheres starting at i, keeps the closest hit per lane. best_base is
+// the start of the vector each lane's hit came from, the sphere is that plus the lane.
+inline void sphere_soa_step(const sphere_soa& s, int i, int end, const vfloat<simd_width> *o,
+                            const vfloat<simd_width> *d, const vfloat<simd_width>& a, float t_min,
+                            vfloat<simd_width>& best_t, vfloat<simd_width>& best_base)
+{
+    typedef vfloat<simd_width> vf;
+    vf ocx = o[0] - vf::loadu(s.center_x + i);
+    vf ocy = o[1] - vf::loadu(s.center_y + i);
+    vf ocz = o[2] - vf::loadu(s.center_z + i);
+    vf radius = vf::loadu(s.radius + i);
+    vf b = ocx*d[0] + ocy*d[1] + ocz*d[2];
+    vf c = ocx*ocx + ocy*ocy + ocz*ocz - radius*radius;
+    vf discriminant = b*b - a*c;
+    // lanes past end are masked, float(end - i) is only inexact when it is far more than a vector
+    vmask<simd_width> valid = (discriminant > vf(0.0f)) & (vf::lane_index() < vf(float(end - i)));
+    if (!movemask(valid)) return;
+
+    // square root once, both roots come from it
+    vf root = vsqrt(vmax(discriminant, vf(0.0f)));
+    vf t0 = (vf(0.0f) - b - root) / a;
+    vf t1 = (root - b) / a;
+    vmask<simd_width> m0 = valid & (t0 < best_t) & (t0 > vf(t_min));
+    vmask<simd_width> m1 = valid & (t1 < best_t) & (t1 > vf(t_min));
+    vmask<simd_width> m = m0 | m1;
+    best_t = select(m, select(m0, t0, t1), best_t);
+    best_base = select(m, vf(int_bits(i)), best_base);
+}
+
+bool sphere_soa::hit_range(const ray& r, float t_min, float t_max, int begin, int end, hit_record& rec) const
+{
+    typedef vfloat<simd_width> vf;
+    vf o[3] = {vf(r.origin().x()), vf(r.origin().y()), vf(r.origin().z())};
+    vf d[3] = {vf(r.direction().x()), vf(r.direction().y()), vf(r.direction().z())};
+    vf a(dot(r.direction(), r.direction()));
+    vf best_t(t_max);
+    vf best_base(int_bits(-1));
+    int i = begin;
+    for (; i + simd_width < end; i += 2*simd_width)
+    {
+        sphere_soa_step(*this, i, end, o, d, a, t_min, best_t, best_base);
+        sphere_soa_step(*this, i + simd_width, end, o, d, a, t_min, best_t, best_base);
+    }
+    // small BVH leaves fit in one vector
+    if (i < end)
+    {
+        sphere_soa_step(*this, i, end, o, d, a, t_min, best_t, best_base);
+    }
+
+    alignas(32) float t[simd_width];
+    alignas(32) float base[simd_width];
+    best_t.store(t);
+    best_base.store(base);
+    int best = -1;
+    for (int l = 0; l < simd_width; l++)
+    {
+        if (float_bits(base[l]) >= 0 && (best < 0 || t[l] < t[best]))
+        {
+            best = l;
+        }
+    }
+    if (best < 0) return false;
+
+    rec.t = t[best];
+    rec.obj = this;
+    rec.prim_id = float_bits(base[best]) + best;
+    rec.inst = NULL;
+    return true;
+}
+
+void sphere_soa::finalize(const ray& r, hit_record& rec) const
+{
+    int i = rec.prim_id;
+    vec3 center(center_x[i], center_y[i], center_z[i]);
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = (rec.p - center) / radius[i];
+    get_sphere_uv(rec.normal, rec.u, rec.v);
+    rec.mat_ptr = materials[material_index[i]];
+}
+
+bool sphere_soa::occluded(const ray& r, float t_min, float t_max) const
+{
+    return occluded_range(r, t_min, t_max, 0, count);
+}
+
+// any sphere in [begin, end) with a root inside (t_min, t_max), one vector at a time
+bool sphere_soa::occluded_range(const ray& r, float t_min, float t_max, int begin, int end) const
+{
+    typedef vfloat<simd_width> vf;
+    vf o[3] = {vf(r.origin().x()), vf(r.origin().y()), vf(r.origin().z())};
+    vf d[3] = {vf(r.direction().x()), vf(r.direction().y()), vf(r.direction().z())};
+    vf a(dot(r.direction(), r.direction()));
+    for (int i = begin; i < end; i += simd_width)
+    {
+        vf ocx = o[0] - vf::loadu(center_x + i);
+        vf ocy = o[1] - vf::loadu(center_y + i);
+        vf ocz = o[2] - vf::loadu(center_z + i);
+        vf rad = vf::loadu(radius + i);
+        vf b = ocx*d[0] + ocy*d[1] + ocz*d[2];
+        vf c = ocx*ocx + ocy*ocy + ocz*ocz - rad*rad;
+        vf discriminant = b*b - a*c;
+        vmask<simd_width> valid = (discriminant > vf(0.0f)) & (vf::lane_index() < vf(float(end - i)));
+        if (!movemask(valid)) continue;
+
+        vf root = vsqrt(vmax(discriminant, vf(0.0f)));
+        vf t0 = (vf(0.0f) - b - root) / a;
+        vf t1 = (root - b) / a;
+        vmask<simd_width> m0 = (t0 < vf(t_max)) & (t0 > vf(t_min));
+        vmask<simd_width> m1 = (t1 < vf(t_max)) & (t1 > vf(t_min));
+        if (movemask(valid & (m0 | m1))) return true;
+    }
+    return false;
+}
+
+bool sphere_soa::bounding_box(aabb& box) const
+{
+    if (count < 1) return false;
+    for (int i = 0; i < count; i++)
+    {
+        float r = fabs(radius[i]);
+        aabb b(vec3(center_x[i]-r, center_y[i]-r, center_z[i]-r), vec3(center_x[i]+r, center_y[i]+r, center_z[i]+r));
+        box = i == 0 ? b : surrounding_box(box, b);
+    }
+    return true;
+}
+
+#endif //SPHERESOAH
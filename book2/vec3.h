@@ -1,12 +1,36 @@
+#ifndef VEC3H
+#define VEC3H
+
 #include <math.h>
 #include <stdlib.h>
 #include <iostream>
 
+// three floats by default. built with -DVEC3_SIMD a vec3 is one 4 wide SSE or NEON
+// register instead (x, y, z and a zero lane, 16 byte aligned), every operator is one
+// or a few instructions and unit_vector() uses the reciprocal square root estimate.
+// the interface is the same, results differ from the scalar ones in the last bits
+#if defined(VEC3_SIMD) && defined(__SSE2__)
+#include <immintrin.h>
+#define VEC3_VECTOR
+typedef __m128 vec3_register;
+#elif defined(VEC3_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define VEC3_VECTOR
+typedef float32x4_t vec3_register;
+#endif
+
 class vec3
 {
 public:
+#ifdef VEC3_VECTOR
+    // zeroed, so the unused lane never holds a denormal or NaN
+    vec3();
+    vec3(float e0, float e1, float e2);
+    vec3(vec3_register v) : m(v) {}
+#else
     vec3() {}
     vec3(float e0, float e1, float e2) {e[0]=e0;e[1]=e1;e[2]=e2;}
+#endif
     inline float x() const { return e[0]; }
     inline float y() const { return e[1]; }
     inline float z() const { return e[2]; }
@@ -15,7 +39,7 @@ public:
     inline float b() const { return e[2]; }
 
     inline const vec3& operator+() const {return *this; }
-    inline vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
+    inline vec3 operator-() const;
     inline float operator[](int i) const {return e[i];}
     inline float& operator[](int i) {return e[i]; }
 
@@ -26,11 +50,19 @@ public:
     inline vec3& operator*=(const float t);
     inline vec3& operator/=(const float t);
 
-    inline float length() const {return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]); }
-    inline float squared_length() const {return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
+    inline float length() const;
+    inline float squared_length() const;
     inline void make_unit_vector();
 
+#ifdef VEC3_VECTOR
+    union
+    {
+        vec3_register m;
+        float e[4];
+    };
+#else
     float e[3];
+#endif
 };
 
 inline std::istream& operator>>(std::istream &is, vec3 &t)
@@ -48,6 +80,11 @@ inline std::ostream& operator<<(std::ostream &os, const vec3 &t)
     os << t.e[0] << " " << t.e[1] << " " << t.e[2];
     return os;
 }
+#ifndef VEC3_VECTOR
+
+inline vec3 vec3::operator-() const { return vec3(-e[0], -e[1], -e[2]); }
+inline float vec3::length() const {return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]); }
+inline float vec3::squared_length() const {return e[0]*e[0] + e[1]*e[1] + e[2]*e[2]; }
 inline void vec3::make_unit_vector() 
 {
     float k = 1.0 / sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
@@ -140,3 +177,98 @@ inline vec3& vec3::operator/=(const float t)
 inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
+
+#else
+
+#ifdef __SSE2__
+inline vec3_register vec3_set(float x, float y, float z) { return _mm_set_ps(0, z, y, x); }
+inline vec3_register vec3_splat(float t) { return _mm_set1_ps(t); }
+inline vec3_register vec3_add(vec3_register a, vec3_register b) { return _mm_add_ps(a, b); }
+inline vec3_register vec3_sub(vec3_register a, vec3_register b) { return _mm_sub_ps(a, b); }
+inline vec3_register vec3_mul(vec3_register a, vec3_register b) { return _mm_mul_ps(a, b); }
+inline vec3_register vec3_div(vec3_register a, vec3_register b) { return _mm_div_ps(a, b); }
+inline vec3_register vec3_neg(vec3_register a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+// (0, 0, 0, 1)
+inline vec3_register vec3_unit_w() { return _mm_set_ps(1, 0, 0, 0); }
+// (y, z, x, w)
+inline vec3_register vec3_yzx(vec3_register a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+// one multiply for the three products, summed in the scalar order
+inline float vec3_dot(vec3_register a, vec3_register b)
+{
+    __m128 p = _mm_mul_ps(a, b);
+    __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_movehl_ps(p, p);
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(p, y), z));
+}
+// 12 bit estimate and one newton step, about 22 bits
+inline float vec3_rsqrt(float x)
+{
+    float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return y * (1.5f - 0.5f*x*y*y);
+}
+#else
+inline vec3_register vec3_set(float x, float y, float z) { float v[4] = {x, y, z, 0}; return vld1q_f32(v); }
+inline vec3_register vec3_splat(float t) { return vdupq_n_f32(t); }
+inline vec3_register vec3_add(vec3_register a, vec3_register b) { return vaddq_f32(a, b); }
+inline vec3_register vec3_sub(vec3_register a, vec3_register b) { return vsubq_f32(a, b); }
+inline vec3_register vec3_mul(vec3_register a, vec3_register b) { return vmulq_f32(a, b); }
+inline vec3_register vec3_div(vec3_register a, vec3_register b) { return vdivq_f32(a, b); }
+inline vec3_register vec3_neg(vec3_register a) { return vnegq_f32(a); }
+inline vec3_register vec3_unit_w() { return vsetq_lane_f32(1, vdupq_n_f32(0), 3); }
+// (y, z, x, 0)
+inline vec3_register vec3_yzx(vec3_register a)
+{
+    return vsetq_lane_f32(vgetq_lane_f32(a, 0), vextq_f32(a, vdupq_n_f32(0), 1), 2);
+}
+inline float vec3_dot(vec3_register a, vec3_register b)
+{
+    float32x4_t p = vmulq_f32(a, b);
+    return vgetq_lane_f32(p, 0) + vgetq_lane_f32(p, 1) + vgetq_lane_f32(p, 2);
+}
+// 8 bit estimate and two newton steps
+inline float vec3_rsqrt(float x)
+{
+    float y = vrsqrtes_f32(x);
+    y *= vrsqrtss_f32(x*y, y);
+    y *= vrsqrtss_f32(x*y, y);
+    return y;
+}
+#endif
+
+inline vec3::vec3() : m(vec3_splat(0)) {}
+inline vec3::vec3(float e0, float e1, float e2) : m(vec3_set(e0, e1, e2)) {}
+
+inline vec3 vec3::operator-() const { return vec3_neg(m); }
+inline float vec3::length() const { return sqrt(vec3_dot(m, m)); }
+inline float vec3::squared_length() const { return vec3_dot(m, m); }
+inline void vec3::make_unit_vector()
+{
+    m = vec3_mul(m, vec3_splat(vec3_rsqrt(vec3_dot(m, m))));
+}
+inline vec3 operator+(const vec3 &v1, const vec3 &v2) { return vec3_add(v1.m, v2.m); }
+inline vec3 operator-(const vec3 &v1, const vec3 &v2) { return vec3_sub(v1.m, v2.m); }
+inline vec3 operator*(const vec3 &v1, const vec3 &v2) { return vec3_mul(v1.m, v2.m); }
+// the unused lane is divided by 1, not 0
+inline vec3 operator/(const vec3 &v1, const vec3 &v2) { return vec3_div(v1.m, vec3_add(v2.m, vec3_unit_w())); }
+inline vec3 operator*(float t, const vec3 &v) { return vec3_mul(vec3_splat(t), v.m); }
+inline vec3 operator*(const vec3 &v, float t) { return vec3_mul(vec3_splat(t), v.m); }
+inline vec3 operator/(const vec3 &v, float t) { return vec3_div(v.m, vec3_splat(t)); }
+inline float dot(const vec3 &v1, const vec3 &v2) { return vec3_dot(v1.m, v2.m); }
+// a * b.yzx - a.yzx * b is the cross product in (z, x, y) order
+inline vec3 cross(const vec3 &v1, const vec3 &v2)
+{
+    return vec3_yzx(vec3_sub(vec3_mul(v1.m, vec3_yzx(v2.m)), vec3_mul(vec3_yzx(v1.m), v2.m)));
+}
+inline vec3& vec3::operator+=(const vec3 &v) { m = vec3_add(m, v.m); return *this; }
+inline vec3& vec3::operator-=(const vec3 &v) { m = vec3_sub(m, v.m); return *this; }
+inline vec3& vec3::operator*=(const vec3 &v) { m = vec3_mul(m, v.m); return *this; }
+inline vec3& vec3::operator/=(const vec3 &v) { *this = *this / v; return *this; }
+inline vec3& vec3::operator*=(const float t) { m = vec3_mul(m, vec3_splat(t)); return *this; }
+inline vec3& vec3::operator/=(const float t) { m = vec3_mul(m, vec3_splat(1.0f/t)); return *this; }
+inline vec3 unit_vector(vec3 v) {
+    return vec3_mul(v.m, vec3_splat(vec3_rsqrt(vec3_dot(v.m, v.m))));
+}
+
+#endif
+
+#endif //VEC3H
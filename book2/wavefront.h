@@ -0,0 +1,479 @@
+#ifndef WAVEFRONTH
+#define WAVEFRONTH
+
+#include "hitable.h"
+#include "camera.h"
+#include "material.h"
+#include "lights.h"
+#include "film.h"
+#include "parallel.h"
+#include "render_settings.h"
+#include "bvh_build.h"
+
+// calls the methods of material class M without virtual dispatch, so a batch of hits
+// with the same kind runs one tight loop. material itself dispatches as usual
+template <class M>
+struct material_calls
+{
+    static vec3 emitted(const material *m, float u, float v, const vec3& p)
+    {
+        return static_cast<const M *>(m)->M::emitted(u, v, p);
+    }
+    static bool is_emissive(const material *m)
+    {
+        return static_cast<const M *>(m)->M::is_emissive();
+    }
+    static bool scatter(const material *m, const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rnd)
+    {
+        return static_cast<const M *>(m)->M::scatter(r_in, rec, attenuation, scattered, rnd);
+    }
+    static float scattering_pdf(const material *m, const ray& r_in, const hit_record& rec, const ray& scattered)
+    {
+        return static_cast<const M *>(m)->M::scattering_pdf(r_in, rec, scattered);
+    }
+};
+
+template <>
+struct material_calls<material>
+{
+    static vec3 emitted(const material *m, float u, float v, const vec3& p) { return m->emitted(u, v, p); }
+    static bool is_emissive(const material *m) { return m->is_emissive(); }
+    static bool scatter(const material *m, const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rnd)
+    {
+        return m->scatter(r_in, rec, attenuation, scattered, rnd);
+    }
+    static float scattering_pdf(const material *m, const ray& r_in, const hit_record& rec, const ray& scattered)
+    {
+        return m->scattering_pdf(r_in, rec, scattered);
+    }
+};
+
+// three float arrays, one per component
+struct vec3_array
+{
+    void allocate(int n) { for (int c = 0; c < 3; c++) e[c] = new float[n]; }
+    void release() { for (int c = 0; c < 3; c++) delete [] e[c]; }
+    vec3 get(int i) const { return vec3(e[0][i], e[1][i], e[2][i]); }
+    void set(int i, const vec3& v) { e[0][i] = v[0]; e[1][i] = v[1]; e[2][i] = v[2]; }
+    void move(int from, int to) { e[0][to] = e[0][from]; e[1][to] = e[1][from]; e[2][to] = e[2][from]; }
+
+    float *e[3];
+};
+
+// wavefront path tracer. instead of following one path to its end it keeps up to
+// wave_size paths in structure of arrays form and advances all of them one bounce
+// at a time, in stages: camera rays fill the free slots, every path is intersected,
+// hits are sorted by material kind and each kind is shaded in its own loop, the
+// shadow rays of light sampling are traced as a batch right behind, and finished paths
+// go to the film while the live ones are compacted to the front. the stages are split
+// between nt threads that stay up for the whole frame and wait for each other between
+// stages, sorting and compaction are cheap serial passes.
+// paths get the same random numbers as in color(), so the image matches the tile
+// renderer's up to rounding. fixed sample counts only, adaptive sampling needs the
+// tile renderer
+class wavefront_renderer
+{
+    public:
+        wavefront_renderer(hitable *w, const light_sampler *l, const camera *c, const render_settings& s, int threads, int size);
+        ~wavefront_renderer();
+        // adds settings.ns samples to every pixel of image, starting at settings.first_sample
+        void render(film& image);
+        void generate(int begin, int end, long long first_work, const film& image);
+        void sort_rays(int n);
+        void intersect(int begin, int end);
+        void sort(int n);
+        template <class M>
+        void shade(int begin, int end);
+        void shade_range(int begin, int end);
+        void trace_shadows(int begin, int end);
+        int compact(int n, film& image);
+
+        hitable *world;
+        const light_sampler *lights;
+        const camera *cam;
+        render_settings settings;
+        int nt;
+        int wave_size;
+
+        // path state, one slot per path
+        vec3_array origin, direction;
+        vec3_array throughput, radiance;
+        float *scattering_pdf;     // of the last bounce, 0 after mirrors and glass
+        vec3_array scattering_normal;
+        int *pixel;
+        int *depth;
+        bool *alive;
+        sampler **samplers;
+        // per bounce
+        int *ray_order;            // slots in the order the intersect stage takes them
+        unsigned short *ray_keys;  // 16 bits sort in two radix passes
+        hit_record *hits;
+        unsigned char *kind;       // material kind of the hit, MATERIAL_KIND_COUNT for misses
+        int *order;                // slots sorted by kind
+        int kind_begin[MATERIAL_KIND_COUNT+2];
+        bool *has_shadow;
+        vec3_array shadow_direction;
+        float *shadow_dist;
+        vec3_array shadow_contribution;
+};
+
+wavefront_renderer::wavefront_renderer(hitable *w, const light_sampler *l, const camera *c, const render_settings& s, int threads, int size)
+{
+    world = w;
+    lights = l;
+    cam = c;
+    settings = s;
+    nt = threads;
+    wave_size = size;
+    origin.allocate(wave_size);
+    direction.allocate(wave_size);
+    throughput.allocate(wave_size);
+    radiance.allocate(wave_size);
+    scattering_pdf = new float[wave_size];
+    scattering_normal.allocate(wave_size);
+    pixel = new int[wave_size];
+    depth = new int[wave_size];
+    alive = new bool[wave_size];
+    samplers = new sampler*[wave_size];
+    for (int i = 0; i < wave_size; i++)
+    {
+        samplers[i] = new_sampler(settings.sampling, settings.frame, settings.seed);
+    }
+    ray_order = new int[wave_size];
+    ray_keys = new unsigned short[wave_size];
+    hits = new hit_record[wave_size];
+    kind = new unsigned char[wave_size];
+    order = new int[wave_size];
+    has_shadow = new bool[wave_size];
+    shadow_direction.allocate(wave_size);
+    shadow_dist = new float[wave_size];
+    shadow_contribution.allocate(wave_size);
+}
+
+wavefront_renderer::~wavefront_renderer()
+{
+    origin.release();
+    direction.release();
+    throughput.release();
+    radiance.release();
+    delete [] scattering_pdf;
+    scattering_normal.release();
+    delete [] pixel;
+    delete [] depth;
+    delete [] alive;
+    for (int i = 0; i < wave_size; i++)
+    {
+        delete samplers[i];
+    }
+    delete [] samplers;
+    delete [] ray_order;
+    delete [] ray_keys;
+    delete [] hits;
+    delete [] kind;
+    delete [] order;
+    delete [] has_shadow;
+    shadow_direction.release();
+    delete [] shadow_dist;
+    shadow_contribution.release();
+}
+
+void wavefront_renderer::render(film& image)
+{
+    long long total = (long long)image.nx * image.ny * settings.ns;
+    long long next = 0;
+    int live = 0;
+    // the same threads run every stage of the frame and meet between stages,
+    // thread 0 also does the serial passes
+    parallel_team(nt, [&](int thread, thread_team& team) {
+        int begin, end;
+        while (true)
+        {
+            // refill the free slots with camera paths. live and next only change
+            // in thread 0's compaction, after the last wait of the wave
+            int count = int(total - next < wave_size - live ? total - next : wave_size - live);
+            int n = live + count;
+            team.range(count, thread, begin, end);
+            generate(live + begin, live + end, next + begin, image);
+            team.sync();
+            if (n == 0)
+            {
+                break;
+            }
+            if (settings.reorder_rays)
+            {
+                if (thread == 0)
+                {
+                    sort_rays(n);
+                }
+                team.sync();
+            }
+
+            team.range(n, thread, begin, end);
+            intersect(begin, end);
+            team.sync();
+            if (thread == 0)
+            {
+                sort(n);
+            }
+            team.sync();
+            team.range(kind_begin[MATERIAL_KIND_COUNT], thread, begin, end);
+            shade_range(begin, end);
+            trace_shadows(begin, end);
+            team.sync();
+            if (thread == 0)
+            {
+                next += count;
+                live = compact(n, image);
+            }
+            team.sync();
+        }
+    });
+}
+
+// slot begin + k starts work item first_work + k, the ns samples of a pixel are
+// consecutive work items so neighbouring slots trace coherent camera rays
+void wavefront_renderer::generate(int begin, int end, long long first_work, const film& image)
+{
+    for (int i = begin; i < end; i++)
+    {
+        long long work = first_work + (i - begin);
+        int p = int(work / settings.ns);
+        int s = int(work % settings.ns);
+        int x = p % image.nx;
+        int y = p / image.nx;
+        sampler& rnd = *samplers[i];
+        rnd.start_sample(x, y, settings.first_sample + s);
+        float u = float(x + rnd.next_float()) / float(image.nx);
+        float v = float(y + rnd.next_float()) / float(image.ny);
+        ray r = cam->get_ray(u, v, rnd);
+        origin.set(i, r.origin());
+        direction.set(i, r.direction());
+        throughput.set(i, vec3(1,1,1));
+        radiance.set(i, vec3(0,0,0));
+        scattering_pdf[i] = 0;
+        pixel[i] = p;
+        depth[i] = 0;
+        alive[i] = true;
+    }
+}
+
+// key of a secondary ray: its direction octant above a 12 bit Morton code of its
+// origin in the bounds of all secondary origins, a 16^3 grid. camera rays get key 0 and the sort
+// is stable, so they stay first and in pixel order, which is coherent already
+void wavefront_renderer::sort_rays(int n)
+{
+    for (int k = 0; k < n; k++)
+    {
+        ray_order[k] = k;
+    }
+    vec3 lo(MAXFLOAT, MAXFLOAT, MAXFLOAT);
+    vec3 hi(-MAXFLOAT, -MAXFLOAT, -MAXFLOAT);
+    for (int i = 0; i < n; i++)
+    {
+        if (depth[i] == 0) continue;
+        for (int a = 0; a < 3; a++)
+        {
+            lo[a] = ffmin(lo[a], origin.e[a][i]);
+            hi[a] = ffmax(hi[a], origin.e[a][i]);
+        }
+    }
+    vec3 scale;
+    for (int a = 0; a < 3; a++)
+    {
+        scale[a] = hi[a] > lo[a] ? 1 / (hi[a] - lo[a]) : 0;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (depth[i] == 0)
+        {
+            ray_keys[i] = 0;
+            continue;
+        }
+        unsigned int octant = (direction.e[0][i] < 0) << 2 | (direction.e[1][i] < 0) << 1 | (direction.e[2][i] < 0);
+        unsigned int code = morton_code<unsigned int>((origin.get(i) - lo) * scale);
+        ray_keys[i] = (unsigned short)((octant + 1) << 12 | code >> 18);
+    }
+    radix_sort(ray_keys, ray_order, n, 1);
+}
+
+// takes the slots in ray_order when rays are reordered, hits stay in their slots
+void wavefront_renderer::intersect(int begin, int end)
+{
+    for (int k = begin; k < end; k++)
+    {
+        int i = settings.reorder_rays ? ray_order[k] : k;
+        ray r(origin.get(i), direction.get(i));
+        hit_record& rec = hits[i];
+        has_shadow[i] = false;
+        if (!world->hit(r, 0.001, MAXFLOAT, rec))
+        {
+            alive[i] = false;
+            kind[i] = MATERIAL_KIND_COUNT;
+            continue;
+        }
+        finalize_hit(r, rec);
+        kind[i] = (unsigned char)rec.mat_ptr->kind();
+    }
+}
+
+// counting sort of the slots by material kind, misses go last
+void wavefront_renderer::sort(int n)
+{
+    int counts[MATERIAL_KIND_COUNT+1] = {0};
+    for (int i = 0; i < n; i++)
+    {
+        counts[kind[i]]++;
+    }
+    kind_begin[0] = 0;
+    for (int k = 0; k <= MATERIAL_KIND_COUNT; k++)
+    {
+        kind_begin[k+1] = kind_begin[k] + counts[k];
+    }
+    int offset[MATERIAL_KIND_COUNT+1];
+    for (int k = 0; k <= MATERIAL_KIND_COUNT; k++)
+    {
+        offset[k] = kind_begin[k];
+    }
+    for (int i = 0; i < n; i++)
+    {
+        order[offset[kind[i]]++] = i;
+    }
+}
+
+// shades the part of the sorted order in [begin, end), one loop per kind
+void wavefront_renderer::shade_range(int begin, int end)
+{
+    for (int k = 0; k < MATERIAL_KIND_COUNT; k++)
+    {
+        int b = kind_begin[k] > begin ? kind_begin[k] : begin;
+        int e = kind_begin[k+1] < end ? kind_begin[k+1] : end;
+        if (b >= e) continue;
+        switch (k)
+        {
+            case MATERIAL_LAMBERTIAN: shade<lambertian>(b, e); break;
+            case MATERIAL_METAL: shade<metal>(b, e); break;
+            case MATERIAL_DIELECTRIC: shade<dielectric>(b, e); break;
+            case MATERIAL_DIFFUSE_LIGHT: shade<diffuse_light>(b, e); break;
+            default: shade<material>(b, e); break;
+        }
+    }
+}
+
+// one bounce of color() for the slots order[begin, end), which all have material
+// class M. light sampling only queues its shadow ray
+template <class M>
+void wavefront_renderer::shade(int begin, int end)
+{
+    for (int k = begin; k < end; k++)
+    {
+        int i = order[k];
+        const hit_record& rec = hits[i];
+        const material *mat = rec.mat_ptr;
+        ray r(origin.get(i), direction.get(i));
+        vec3 beta = throughput.get(i);
+        vec3 col = radiance.get(i);
+
+        vec3 emitted = material_calls<M>::emitted(mat, rec.u, rec.v, rec.p);
+        float weight = 1;
+        int light = settings.light_sampling && scattering_pdf[i] > 0 && material_calls<M>::is_emissive(mat) ? lights->find(rec) : -1;
+        if (light >= 0)
+        {
+            float light_pdf = lights->probability(r.origin(), scattering_normal.get(i), light) * sphere_light_pdf(lights->light(light), r.origin());
+            weight = mis_weight(scattering_pdf[i], light_pdf);
+        }
+        col += beta*emitted*weight;
+        radiance.set(i, col);
+
+        ray scattered;
+        vec3 attenuation;
+        sampler& rnd = *samplers[i];
+        rnd.start_dimensions(bounce_dimension(depth[i], bsdf_dimension), 4);
+        if (depth[i] >= settings.max_depth || !material_calls<M>::scatter(mat, r, rec, attenuation, scattered, rnd))
+        {
+            alive[i] = false;
+            continue;
+        }
+        float pdf = material_calls<M>::scattering_pdf(mat, r, rec, scattered);
+        scattering_pdf[i] = pdf;
+        scattering_normal.set(i, rec.normal);
+        ray shadow;
+        float dist;
+        vec3 contribution;
+        if (settings.light_sampling && pdf > 0 &&
+            sample_light(r, rec, attenuation, *lights, depth[i], rnd, shadow, dist, contribution))
+        {
+            has_shadow[i] = true;
+            shadow_direction.set(i, shadow.direction());
+            shadow_dist[i] = dist;
+            shadow_contribution.set(i, beta*contribution);
+        }
+        beta *= attenuation;
+
+        if (depth[i] >= settings.rr_depth)
+        {
+            float p = ffmin(0.95f, ffmax(beta[0], ffmax(beta[1], beta[2])));
+            rnd.start_dimensions(bounce_dimension(depth[i], roulette_dimension), 1);
+            if (rnd.next_float() >= p)
+            {
+                alive[i] = false;
+                continue;
+            }
+            beta /= p;
+        }
+        throughput.set(i, beta);
+        origin.set(i, scattered.origin());
+        direction.set(i, scattered.direction());
+        depth[i]++;
+    }
+}
+
+// shadow rays of the slots order[begin, end), which start at the hit point of their slot
+void wavefront_renderer::trace_shadows(int begin, int end)
+{
+    for (int k = begin; k < end; k++)
+    {
+        int i = order[k];
+        if (!has_shadow[i]) continue;
+        ray shadow(hits[i].p, shadow_direction.get(i));
+        if (!world->occluded(shadow, 0.001, shadow_dist[i]*0.999f))
+        {
+            radiance.set(i, radiance.get(i) + shadow_contribution.get(i));
+        }
+    }
+}
+
+// adds finished paths to the film and moves the live ones to the front, keeping their
+// order. returns the number of live paths
+int wavefront_renderer::compact(int n, film& image)
+{
+    int live = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (!alive[i])
+        {
+            vec3 col = radiance.get(i);
+            float l = luminance(col);
+            image.add(pixel[i] % image.nx, pixel[i] / image.nx, col, l*l, 1);
+            continue;
+        }
+        if (i != live)
+        {
+            origin.move(i, live);
+            direction.move(i, live);
+            throughput.move(i, live);
+            radiance.move(i, live);
+            scattering_pdf[live] = scattering_pdf[i];
+            scattering_normal.move(i, live);
+            pixel[live] = pixel[i];
+            depth[live] = depth[i];
+            alive[live] = true;
+            sampler *s = samplers[live];
+            samplers[live] = samplers[i];
+            samplers[i] = s;
+        }
+        live++;
+    }
+    return live;
+}
+
+#endif //WAVEFRONTH
@@ -0,0 +1,675 @@
+#ifndef WIDEBVHH
+#define WIDEBVHH
+
+#include <vector>
+#include "bvh_build.h"
+#include "sphere.h"
+#include "simd.h"
+
+// W children per node with their boxes stored per axis, so one SIMD slab
+// test covers every child. unused slots get an inverted box that never hits.
+template <int W>
+struct alignas(64) wide_bvh_node
+{
+    float bounds[2][3][W]; // [min/max][axis][child]
+    // interior children index nodes, leaf children index sphere blocks
+    int child[W];
+    int block_count[W]; // 0 for interior children
+};
+
+// W spheres packed for the SIMD quadratic, short blocks repeat their last sphere
+template <int W>
+struct alignas(32) sphere_block
+{
+    float center[3][W];
+    float radius[W];
+    int index[W];
+};
+
+// BVH4/BVH8, the binary build tree collapsed into W wide nodes
+template <int W>
+class wide_bvh : public hitable
+{
+    public:
+        wide_bvh() {}
+        wide_bvh(sphere **l, int n, bvh_builder b = BVH_BINNED_SAH, int threads = 1);
+        virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual int hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const;
+        virtual bool bounding_box(aabb& box) const;
+        void build(sphere **l, int n);
+        int collapse(const bvh_build_node *node);
+        void set_child(int node, int slot, const bvh_build_node *child);
+        virtual bool occluded(const ray& r, float t_min, float t_max) const;
+        virtual void finalize(const ray& r, hit_record& rec) const;
+        bool hit_block(const sphere_block<W>& block, const ray& r, float t_min, float t_max, hit_record& rec) const;
+        bool occluded_block(const sphere_block<W>& block, const ray& r, float t_min, float t_max) const;
+        bool update(sphere **l, int n);
+        void refit_node(int i);
+        void refit_top(int node, int end, int depth, int split_depth, std::vector<int>& top, std::vector<int>& sub);
+        float sah_cost() const;
+
+        std::vector<wide_bvh_node<W> > nodes;
+        std::vector<sphere_block<W> > blocks;
+        sphere *spheres;
+        int sphere_count;
+        // input index of every sphere in leaf order, so update() can find its new data
+        int *sphere_index;
+        aabb box;
+        bvh_builder builder;
+        int nt;
+        float built_cost;
+};
+
+typedef wide_bvh<4> bvh4;
+typedef wide_bvh<8> bvh8;
+
+template <int W>
+wide_bvh<W>::wide_bvh(sphere **l, int n, bvh_builder b, int threads)
+{
+    builder = b;
+    nt = threads;
+    build(l, n);
+}
+
+template <int W>
+void wide_bvh<W>::build(sphere **l, int n)
+{
+    bvh_primitive *prims = make_bvh_primitives(l, n);
+    bvh_build_node *root = build_bvh_tree(prims, n, builder, nt);
+
+    // spheres are kept in leaf order, blocks index into them
+    sphere_count = n;
+    spheres = new sphere[n];
+    sphere_index = new int[n];
+    for (int i = 0; i < n; i++)
+    {
+        spheres[i] = *l[prims[i].index];
+        sphere_index[i] = prims[i].index;
+    }
+
+    box = root->bounds;
+    if (root->n_primitives > 0 || root->prim_count <= W)
+    {
+        // tiny scene, a single node with one leaf
+        nodes.resize(1);
+        for (int s = 0; s < W; s++)
+        {
+            set_child(0, s, s == 0 ? root : NULL);
+        }
+    }
+    else
+    {
+        collapse(root);
+    }
+    free_build_tree(root);
+    delete [] prims;
+    built_cost = sah_cost();
+}
+
+// same contract as linear_bvh::update, refits to new centers and radii of the
+// spheres it was built with and rebuilds if the SAH cost grew too much
+template <int W>
+bool wide_bvh<W>::update(sphere **l, int n)
+{
+    parallel_for(n, nt, [&](int begin, int end, int thread) {
+        for (int i = begin; i < end; i++)
+        {
+            spheres[i].center = l[sphere_index[i]]->center;
+            spheres[i].radius = l[sphere_index[i]]->radius;
+        }
+    });
+    parallel_for(int(blocks.size()), nt, [&](int begin, int end, int thread) {
+        for (int b = begin; b < end; b++)
+        {
+            sphere_block<W>& block = blocks[b];
+            for (int i = 0; i < W; i++)
+            {
+                const sphere& s = spheres[block.index[i]];
+                block.center[0][i] = s.center.x();
+                block.center[1][i] = s.center.y();
+                block.center[2][i] = s.center.z();
+                block.radius[i] = s.radius;
+            }
+        }
+    });
+
+    // collapse emits nodes depth first, so subtrees are contiguous and come after
+    // their parent: refit the ones below split_depth back to front in parallel
+    int split_depth = 0;
+    int reach = 1;
+    while (reach < 4*nt)
+    {
+        reach *= W;
+        split_depth++;
+    }
+    std::vector<int> top, sub;
+    refit_top(0, int(nodes.size()), 0, split_depth, top, sub);
+    parallel_for(int(sub.size())/2, nt, [&](int begin, int end, int thread) {
+        for (int s = begin; s < end; s++)
+        {
+            for (int i = sub[2*s+1]-1; i >= sub[2*s]; i--)
+            {
+                refit_node(i);
+            }
+        }
+    });
+    for (int t = int(top.size())-1; t >= 0; t--)
+    {
+        refit_node(top[t]);
+    }
+    box = aabb(vec3(MAXFLOAT, MAXFLOAT, MAXFLOAT), vec3(-MAXFLOAT, -MAXFLOAT, -MAXFLOAT));
+    for (int s = 0; s < W; s++)
+    {
+        box = surrounding_box(box, aabb(vec3(nodes[0].bounds[0][0][s], nodes[0].bounds[0][1][s], nodes[0].bounds[0][2][s]),
+                                        vec3(nodes[0].bounds[1][0][s], nodes[0].bounds[1][1][s], nodes[0].bounds[1][2][s])));
+    }
+
+    if (sah_cost() > bvh_refit_max_cost_growth * built_cost)
+    {
+        nodes.clear();
+        blocks.clear();
+        delete [] spheres;
+        delete [] sphere_index;
+        build(l, n);
+        return true;
+    }
+    return false;
+}
+
+// interior children of a node are allocated in slot order, so a child's subtree
+// ends where the next interior child starts (or where the parent's ends)
+template <int W>
+void wide_bvh<W>::refit_top(int node, int end, int depth, int split_depth, std::vector<int>& top, std::vector<int>& sub)
+{
+    if (depth == split_depth)
+    {
+        sub.push_back(node);
+        sub.push_back(end);
+        return;
+    }
+    top.push_back(node);
+    int children[W];
+    int count = 0;
+    for (int s = 0; s < W; s++)
+    {
+        if (nodes[node].block_count[s] == 0 && nodes[node].child[s] != 0)
+        {
+            children[count++] = nodes[node].child[s];
+        }
+    }
+    for (int c = 0; c < count; c++)
+    {
+        refit_top(children[c], c+1 < count ? children[c+1] : end, depth+1, split_depth, top, sub);
+    }
+}
+
+template <int W>
+void wide_bvh<W>::refit_node(int i)
+{
+    wide_bvh_node<W>& node = nodes[i];
+    for (int s = 0; s < W; s++)
+    {
+        if (node.block_count[s] == 0 && node.child[s] == 0)
+        {
+            // unused slot, node 0 is the root and never a child
+            continue;
+        }
+        for (int a = 0; a < 3; a++)
+        {
+            node.bounds[0][a][s] = MAXFLOAT;
+            node.bounds[1][a][s] = -MAXFLOAT;
+        }
+        if (node.block_count[s] > 0)
+        {
+            for (int b = node.child[s]; b < node.child[s] + node.block_count[s]; b++)
+            {
+                for (int l = 0; l < W; l++)
+                {
+                    float r = fabs(blocks[b].radius[l]);
+                    for (int a = 0; a < 3; a++)
+                    {
+                        node.bounds[0][a][s] = ffmin(node.bounds[0][a][s], blocks[b].center[a][l] - r);
+                        node.bounds[1][a][s] = ffmax(node.bounds[1][a][s], blocks[b].center[a][l] + r);
+                    }
+                }
+            }
+        }
+        else
+        {
+            // empty slots of the child are inverted boxes, so they drop out of the min/max
+            const wide_bvh_node<W>& c = nodes[node.child[s]];
+            for (int l = 0; l < W; l++)
+            {
+                for (int a = 0; a < 3; a++)
+                {
+                    node.bounds[0][a][s] = ffmin(node.bounds[0][a][s], c.bounds[0][a][l]);
+                    node.bounds[1][a][s] = ffmax(node.bounds[1][a][s], c.bounds[1][a][l]);
+                }
+            }
+        }
+    }
+}
+
+// expected cost of a random ray through the tree relative to the root box
+template <int W>
+float wide_bvh<W>::sah_cost() const
+{
+    double cost = 0;
+    for (int i = 0; i < int(nodes.size()); i++)
+    {
+        for (int s = 0; s < W; s++)
+        {
+            const wide_bvh_node<W>& node = nodes[i];
+            if (node.block_count[s] == 0 && node.child[s] == 0) continue;
+            float dx = node.bounds[1][0][s] - node.bounds[0][0][s];
+            float dy = node.bounds[1][1][s] - node.bounds[0][1][s];
+            float dz = node.bounds[1][2][s] - node.bounds[0][2][s];
+            float area = 2.0f*(dx*dy + dy*dz + dz*dx);
+            cost += area * (node.block_count[s] > 0 ? node.block_count[s] : bvh_traversal_cost);
+        }
+    }
+    return float(cost / box.area());
+}
+
+// opens the binary children with the biggest area until there are W of them
+template <int W>
+int wide_bvh<W>::collapse(const bvh_build_node *node)
+{
+    const bvh_build_node *slots[W];
+    int k = 2;
+    slots[0] = node->children[0];
+    slots[1] = node->children[1];
+    while (k < W)
+    {
+        int best = -1;
+        float best_area = -1;
+        for (int s = 0; s < k; s++)
+        {
+            // subtrees that fit in a block become leaves, so they're never opened
+            if (slots[s]->n_primitives == 0 && slots[s]->prim_count > W && slots[s]->bounds.area() > best_area)
+            {
+                best = s;
+                best_area = slots[s]->bounds.area();
+            }
+        }
+        if (best < 0) break;
+        const bvh_build_node *opened = slots[best];
+        slots[best] = opened->children[0];
+        slots[k++] = opened->children[1];
+    }
+
+    int index = int(nodes.size());
+    nodes.resize(index+1);
+    for (int s = 0; s < W; s++)
+    {
+        set_child(index, s, s < k ? slots[s] : NULL);
+    }
+    return index;
+}
+
+template <int W>
+void wide_bvh<W>::set_child(int node, int slot, const bvh_build_node *child)
+{
+    if (!child)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            nodes[node].bounds[0][a][slot] = MAXFLOAT;
+            nodes[node].bounds[1][a][slot] = -MAXFLOAT;
+        }
+        nodes[node].child[slot] = 0;
+        nodes[node].block_count[slot] = 0;
+        return;
+    }
+
+    for (int a = 0; a < 3; a++)
+    {
+        nodes[node].bounds[0][a][slot] = child->bounds.min()[a];
+        nodes[node].bounds[1][a][slot] = child->bounds.max()[a];
+    }
+    if (child->n_primitives > 0 || child->prim_count <= W)
+    {
+        // pack the whole subtree range into blocks
+        int first_block = int(blocks.size());
+        int count = child->prim_count;
+        int block_count = (count + W-1) / W;
+        blocks.resize(first_block + block_count);
+        for (int i = 0; i < block_count*W; i++)
+        {
+            int prim = child->first_prim_offset + (i < count ? i : count-1);
+            sphere_block<W>& block = blocks[first_block + i/W];
+            block.center[0][i%W] = spheres[prim].center.x();
+            block.center[1][i%W] = spheres[prim].center.y();
+            block.center[2][i%W] = spheres[prim].center.z();
+            block.radius[i%W] = spheres[prim].radius;
+            block.index[i%W] = prim;
+        }
+        nodes[node].child[slot] = first_block;
+        nodes[node].block_count[slot] = block_count;
+    }
+    else
+    {
+        // collapse can grow nodes, so don't hold a reference across it
+        int c = collapse(child);
+        nodes[node].child[slot] = c;
+        nodes[node].block_count[slot] = 0;
+    }
+}
+
+// W sphere quadratics at once, same math as sphere::hit
+template <int W>
+bool wide_bvh<W>::hit_block(const sphere_block<W>& block, const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    typedef vfloat<W> vf;
+    vf ocx = vf(r.origin().x()) - vf::load(block.center[0]);
+    vf ocy = vf(r.origin().y()) - vf::load(block.center[1]);
+    vf ocz = vf(r.origin().z()) - vf::load(block.center[2]);
+    vf radius = vf::load(block.radius);
+    vf dx(r.direction().x()), dy(r.direction().y()), dz(r.direction().z());
+    vf a(dot(r.direction(), r.direction()));
+    vf b = ocx*dx + ocy*dy + ocz*dz;
+    vf c = ocx*ocx + ocy*ocy + ocz*ocz - radius*radius;
+    vf discriminant = b*b - a*c;
+    vmask<W> valid = discriminant > vf(0.0f);
+    if (!movemask(valid)) return false;
+
+    vf root = vsqrt(vmax(discriminant, vf(0.0f)));
+    vf t0 = (vf(0.0f) - b - root) / a;
+    vf t1 = (root - b) / a;
+    vmask<W> m0 = valid & (t0 < vf(t_max)) & (t0 > vf(t_min));
+    vmask<W> m1 = valid & (t1 < vf(t_max)) & (t1 > vf(t_min));
+    int bits = movemask(m0 | m1);
+    if (!bits) return false;
+
+    alignas(32) float t[W];
+    select(m0, t0, t1).store(t);
+    int best = -1;
+    for (int i = 0; i < W; i++)
+    {
+        if (((bits >> i) & 1) && (best < 0 || t[i] < t[best]))
+        {
+            best = i;
+        }
+    }
+
+    rec.t = t[best];
+    rec.obj = this;
+    rec.prim_id = block.index[best];
+    rec.inst = NULL;
+    return true;
+}
+
+template <int W>
+void wide_bvh<W>::finalize(const ray& r, hit_record& rec) const
+{
+    spheres[rec.prim_id].finalize(r, rec);
+}
+
+template <int W>
+bool wide_bvh<W>::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    typedef vfloat<W> vf;
+    vec3 inv_dir(1.0f/r.direction().x(), 1.0f/r.direction().y(), 1.0f/r.direction().z());
+    int dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+    vf ox(r.origin().x()), oy(r.origin().y()), oz(r.origin().z());
+    vf idx(inv_dir.x()), idy(inv_dir.y()), idz(inv_dir.z());
+
+    // entries are (child, block count, entry distance), near children are pushed last
+    int stack_child[W*bvh_stack_size];
+    int stack_blocks[W*bvh_stack_size];
+    float stack_t[W*bvh_stack_size];
+    int sp = 0;
+    stack_child[sp] = 0;
+    stack_blocks[sp] = 0;
+    stack_t[sp++] = t_min;
+
+    bool hit_anything = false;
+    while (sp > 0)
+    {
+        sp--;
+        if (stack_t[sp] > t_max) continue;
+        if (stack_blocks[sp] > 0)
+        {
+            int first = stack_child[sp];
+            for (int b = 0; b < stack_blocks[sp]; b++)
+            {
+                if (hit_block(blocks[first+b], r, t_min, t_max, rec))
+                {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+            continue;
+        }
+
+        const wide_bvh_node<W>& node = nodes[stack_child[sp]];
+        vf tx0 = (vf::load(node.bounds[dir_is_neg[0]][0]) - ox) * idx;
+        vf tx1 = (vf::load(node.bounds[1-dir_is_neg[0]][0]) - ox) * idx;
+        vf ty0 = (vf::load(node.bounds[dir_is_neg[1]][1]) - oy) * idy;
+        vf ty1 = (vf::load(node.bounds[1-dir_is_neg[1]][1]) - oy) * idy;
+        vf tz0 = (vf::load(node.bounds[dir_is_neg[2]][2]) - oz) * idz;
+        vf tz1 = (vf::load(node.bounds[1-dir_is_neg[2]][2]) - oz) * idz;
+        vf tnear = vmax(vmax(tx0, ty0), vmax(tz0, vf(t_min)));
+        vf tfar = vmin(vmin(tx1, ty1), vmin(tz1, vf(t_max)));
+        int bits = movemask(tnear <= tfar);
+        if (!bits) continue;
+
+        alignas(32) float t[W];
+        tnear.store(t);
+        // insertion sort the hit children far to near, then push them in that order
+        int order[W];
+        int hits = 0;
+        for (int i = 0; i < W; i++)
+        {
+            if (!((bits >> i) & 1)) continue;
+            int j = hits++;
+            while (j > 0 && t[order[j-1]] < t[i])
+            {
+                order[j] = order[j-1];
+                j--;
+            }
+            order[j] = i;
+        }
+        for (int h = 0; h < hits; h++)
+        {
+            stack_child[sp] = node.child[order[h]];
+            stack_blocks[sp] = node.block_count[order[h]];
+            stack_t[sp++] = t[order[h]];
+        }
+    }
+    return hit_anything;
+}
+
+// closest hits of a packet, the whole packet walks the tree at once. every node
+// culls its W child boxes against the packet's frustum in one vector pass, with the
+// interval arithmetic of packet_hits_box, and only the boxes left are tested ray by
+// ray. packets that are not coherent go ray by ray
+template <int W>
+int wide_bvh<W>::hit_packet(ray_packet& p, int mask, float t_min, hit_record *recs) const
+{
+    p.prepare();
+    if (!p.coherent)
+    {
+        return hitable::hit_packet(p, mask, t_min, recs);
+    }
+    typedef vfloat<W> vf;
+
+    // entries are (child, block count, rays), near children are pushed last
+    int stack_child[W*bvh_stack_size];
+    int stack_blocks[W*bvh_stack_size];
+    int stack_mask[W*bvh_stack_size];
+    int sp = 0;
+    stack_child[sp] = 0;
+    stack_blocks[sp] = 0;
+    stack_mask[sp++] = mask;
+
+    int hits = 0;
+    while (sp > 0)
+    {
+        sp--;
+        int active = stack_mask[sp];
+        if (stack_blocks[sp] > 0)
+        {
+            int first = stack_child[sp];
+            for (int b = first; b < first + stack_blocks[sp]; b++)
+            {
+                const sphere_block<W>& block = blocks[b];
+                for (int i = 0; i < W; i++)
+                {
+                    // short blocks repeat their last sphere
+                    if (i > 0 && block.index[i] == block.index[i-1]) break;
+                    vec3 center(block.center[0][i], block.center[1][i], block.center[2][i]);
+                    int found = hit_sphere_packet(p, active, t_min, center, block.radius[i]);
+                    for (int k = 0; k < packet_size; k++)
+                    {
+                        if ((found >> k) & 1)
+                        {
+                            recs[k].t = p.t_max[k];
+                            recs[k].obj = this;
+                            recs[k].prim_id = block.index[i];
+                            recs[k].inst = NULL;
+                        }
+                    }
+                    hits |= found;
+                }
+            }
+            continue;
+        }
+
+        const wide_bvh_node<W>& node = nodes[stack_child[sp]];
+        vf entry(t_min);
+        vf exit(MAXFLOAT);
+        for (int a = 0; a < 3; a++)
+        {
+            vf inv_lo(p.inv_min[a]), inv_hi(p.inv_max[a]);
+            vf near = vf::load(node.bounds[p.dir_is_neg[a]][a]);
+            vf far = vf::load(node.bounds[1-p.dir_is_neg[a]][a]);
+            vf n0 = near - vf(p.org_max[a]), n1 = near - vf(p.org_min[a]);
+            vf f0 = far - vf(p.org_max[a]), f1 = far - vf(p.org_min[a]);
+            entry = vmax(entry, vmin(vmin(n0*inv_lo, n0*inv_hi), vmin(n1*inv_lo, n1*inv_hi)));
+            exit = vmin(exit, vmax(vmax(f0*inv_lo, f0*inv_hi), vmax(f1*inv_lo, f1*inv_hi)));
+        }
+        int bits = movemask(entry <= exit);
+        if (!bits) continue;
+
+        alignas(32) float t[W];
+        entry.store(t);
+        // insertion sort the children the frustum reaches far to near
+        int order[W];
+        int count = 0;
+        for (int i = 0; i < W; i++)
+        {
+            if (!((bits >> i) & 1)) continue;
+            int j = count++;
+            while (j > 0 && t[order[j-1]] < t[i])
+            {
+                order[j] = order[j-1];
+                j--;
+            }
+            order[j] = i;
+        }
+        for (int h = 0; h < count; h++)
+        {
+            int s = order[h];
+            float bounds[2][3];
+            for (int a = 0; a < 3; a++)
+            {
+                bounds[0][a] = node.bounds[0][a][s];
+                bounds[1][a] = node.bounds[1][a][s];
+            }
+            int rays = packet_rays_hit_box(bounds, p, active, t_min);
+            if (!rays) continue;
+            stack_child[sp] = node.child[s];
+            stack_blocks[sp] = node.block_count[s];
+            stack_mask[sp++] = rays;
+        }
+    }
+    return hits;
+}
+
+template <int W>
+bool wide_bvh<W>::occluded_block(const sphere_block<W>& block, const ray& r, float t_min, float t_max) const
+{
+    typedef vfloat<W> vf;
+    vf ocx = vf(r.origin().x()) - vf::load(block.center[0]);
+    vf ocy = vf(r.origin().y()) - vf::load(block.center[1]);
+    vf ocz = vf(r.origin().z()) - vf::load(block.center[2]);
+    vf radius = vf::load(block.radius);
+    vf dx(r.direction().x()), dy(r.direction().y()), dz(r.direction().z());
+    vf a(dot(r.direction(), r.direction()));
+    vf b = ocx*dx + ocy*dy + ocz*dz;
+    vf c = ocx*ocx + ocy*ocy + ocz*ocz - radius*radius;
+    vf discriminant = b*b - a*c;
+    vmask<W> valid = discriminant > vf(0.0f);
+    if (!movemask(valid)) return false;
+
+    vf root = vsqrt(vmax(discriminant, vf(0.0f)));
+    vf t0 = (vf(0.0f) - b - root) / a;
+    vf t1 = (root - b) / a;
+    vmask<W> m0 = (t0 < vf(t_max)) & (t0 > vf(t_min));
+    vmask<W> m1 = (t1 < vf(t_max)) & (t1 > vf(t_min));
+    return movemask(valid & (m0 | m1)) != 0;
+}
+
+// any hit traversal, children are pushed unsorted and the first blocking sphere ends it
+template <int W>
+bool wide_bvh<W>::occluded(const ray& r, float t_min, float t_max) const
+{
+    typedef vfloat<W> vf;
+    vec3 inv_dir(1.0f/r.direction().x(), 1.0f/r.direction().y(), 1.0f/r.direction().z());
+    int dir_is_neg[3] = {inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0};
+    vf ox(r.origin().x()), oy(r.origin().y()), oz(r.origin().z());
+    vf idx(inv_dir.x()), idy(inv_dir.y()), idz(inv_dir.z());
+
+    int stack_child[W*bvh_stack_size];
+    int stack_blocks[W*bvh_stack_size];
+    int sp = 0;
+    stack_child[sp] = 0;
+    stack_blocks[sp++] = 0;
+
+    while (sp > 0)
+    {
+        sp--;
+        if (stack_blocks[sp] > 0)
+        {
+            int first = stack_child[sp];
+            for (int b = 0; b < stack_blocks[sp]; b++)
+            {
+                if (occluded_block(blocks[first+b], r, t_min, t_max))
+                {
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        const wide_bvh_node<W>& node = nodes[stack_child[sp]];
+        vf tx0 = (vf::load(node.bounds[dir_is_neg[0]][0]) - ox) * idx;
+        vf tx1 = (vf::load(node.bounds[1-dir_is_neg[0]][0]) - ox) * idx;
+        vf ty0 = (vf::load(node.bounds[dir_is_neg[1]][1]) - oy) * idy;
+        vf ty1 = (vf::load(node.bounds[1-dir_is_neg[1]][1]) - oy) * idy;
+        vf tz0 = (vf::load(node.bounds[dir_is_neg[2]][2]) - oz) * idz;
+        vf tz1 = (vf::load(node.bounds[1-dir_is_neg[2]][2]) - oz) * idz;
+        vf tnear = vmax(vmax(tx0, ty0), vmax(tz0, vf(t_min)));
+        vf tfar = vmin(vmin(tx1, ty1), vmin(tz1, vf(t_max)));
+        int bits = movemask(tnear <= tfar);
+        for (int i = 0; i < W; i++)
+        {
+            if ((bits >> i) & 1)
+            {
+                stack_child[sp] = node.child[i];
+                stack_blocks[sp++] = node.block_count[i];
+            }
+        }
+    }
+    return false;
+}
+
+template <int W>
+bool wide_bvh<W>::bounding_box(aabb& b) const
+{
+    b = box;
+    return true;
+}
+
+#endif //WIDEBVHH